@@ -0,0 +1,51 @@
+#
+# Bash completion for stim: commands, and task paths from the task
+# dictionary for "stim start" and the task paths of the reporting commands.
+#
+# Source this from ~/.bashrc, or copy it into the bash-completion
+# directory (typically /etc/bash_completion.d) as "stim".
+#
+
+_stim_tasks()
+{
+  # what's been typed so far, less any quoting
+  local cur="${COMP_WORDS[COMP_CWORD]}"
+  cur="${cur//\\/}"
+  cur="${cur#[\"\']}"
+
+  local IFS=$'\n'
+  local task
+  COMPREPLY=()
+  for task in $(stim tasks "$cur" 2>/dev/null)
+  do
+    COMPREPLY+=( "$(printf '%q' "$task")" )
+  done
+}
+
+_stim()
+{
+  local cur="${COMP_WORDS[COMP_CWORD]}"
+  local commands="init start stop log status export stats overlaps timeline
+    vacuum sync verify at tasks days report help"
+
+  if [ "$COMP_CWORD" -eq 1 ]
+  then
+    COMPREPLY=( $(compgen -W "$commands" -- "$cur") )
+    return
+  fi
+
+  case "${COMP_WORDS[1]}" in
+    start)
+      [ "$COMP_CWORD" -eq 2 ] && _stim_tasks
+      ;;
+    tasks)
+      [ "$COMP_CWORD" -eq 2 ] && [[ "$cur" != -* ]] && _stim_tasks
+      ;;
+    report|export|stats|timeline|days)
+      # task paths follow the date range
+      [ "$COMP_CWORD" -gt 2 ] && [[ "$cur" != -* ]] && _stim_tasks
+      ;;
+  esac
+}
+
+complete -F _stim stim
@@ -0,0 +1,240 @@
+#include "libstim.h"
+#include "stim.hh"
+
+#include <exception>
+
+
+struct stim_handle
+{
+  Stim* pStim;
+  string sError;
+  string sCurrentTask;
+};
+
+struct stim_cursor
+{
+  stim_handle* pHandle;
+  StimSnapshot* pSnapshot;
+  StimCursor* pCursor;
+  TTimeChunk tChunk;
+  bool bMore;
+};
+
+
+// run a Stim call, turning whatever it throws into the handle's last error
+#define STIM_GUARD(pHandle, call) \
+  try \
+  { \
+    call; \
+  } \
+  catch (const string& sError) \
+  { \
+    (pHandle)->sError = sError; \
+    return -1; \
+  } \
+  catch (const char* szError) \
+  { \
+    (pHandle)->sError = szError; \
+    return -1; \
+  } \
+  catch (const std::exception& e) \
+  { \
+    (pHandle)->sError = e.what(); \
+    return -1; \
+  }
+
+
+extern "C" int stim_abi_version(void)
+{
+  return STIM_ABI_VERSION;
+}
+
+
+extern "C" stim_handle* stim_open(const char* home, const char* contract)
+{
+  if (home == NULL || contract == NULL)
+    return NULL;
+
+  // there's no handle yet to hold an error, so failing is just NULL
+  stim_handle* pHandle = NULL;
+  try
+  {
+    pHandle = new stim_handle;
+    pHandle->pStim = new Stim(home, contract);
+  }
+  catch (...)
+  {
+    delete pHandle;
+    return NULL;
+  }
+  return pHandle;
+}
+
+
+extern "C" void stim_close(stim_handle* handle)
+{
+  if (handle == NULL)
+    return;
+
+  delete handle->pStim;
+  delete handle;
+}
+
+
+extern "C" const char* stim_last_error(stim_handle* handle)
+{
+  return handle->sError.c_str();
+}
+
+
+extern "C" int stim_init(stim_handle* handle)
+{
+  STIM_GUARD(handle, handle->pStim->Initialise());
+  return 1;
+}
+
+
+extern "C" int stim_start(stim_handle* handle, time_t when, const char* task)
+{
+  STIM_GUARD(handle, handle->pStim->StartTask(when, task));
+  return 1;
+}
+
+
+extern "C" int stim_stop(stim_handle* handle, time_t when)
+{
+  STIM_GUARD(handle, handle->pStim->StopTask(when));
+  return 1;
+}
+
+
+extern "C" int stim_log(stim_handle* handle, time_t when, const char* message)
+{
+  STIM_GUARD(handle, handle->pStim->LogTask(when, message));
+  return 1;
+}
+
+
+extern "C" int stim_status(
+    stim_handle* handle,
+    time_t now,
+    stim_status_t* status)
+{
+  TSessionStatus tSession;
+  bool bHaveResults = false;
+  STIM_GUARD(handle, bHaveResults = handle->pStim->Status(now, tSession));
+
+  if (!bHaveResults)
+  {
+    status->session_time = 0;
+    status->task_time = 0;
+    status->transition_time = STIM_TIME_NOTIME;
+    status->current_task = "";
+    status->running = 0;
+    return 0;
+  }
+
+  STIM_GUARD(handle, handle->sCurrentTask = tSession.sCurrentTask);
+  status->session_time = tSession.aSessionTime;
+  status->task_time = tSession.aTaskTime;
+  status->transition_time = tSession.aTransitionTime;
+  status->current_task = handle->sCurrentTask.c_str();
+  status->running = tSession.bRunning ? 1 : 0;
+  return 1;
+}
+
+
+static int BeginReport(
+    stim_cursor* pCursor,
+    time_t now,
+    const char* daterange,
+    vector<string>& vTaskPaths)
+{
+  stim_handle* pHandle = pCursor->pHandle;
+  STIM_GUARD(pHandle,
+    pCursor->pSnapshot = pHandle->pStim->OpenSnapshot();
+    pCursor->pCursor = new StimCursor(*pCursor->pSnapshot);
+    pCursor->bMore = pCursor->pCursor->BeginChunkScan(
+      now, daterange, vTaskPaths));
+  return 1;
+}
+
+
+extern "C" stim_cursor* stim_report_open(
+    stim_handle* handle,
+    time_t now,
+    const char* daterange,
+    const char* const* task_paths,
+    size_t task_path_count)
+{
+  vector<string> vTaskPaths;
+  stim_cursor* pCursor = NULL;
+  try
+  {
+    for (size_t i = 0; i < task_path_count; i++)
+      vTaskPaths.push_back(task_paths[i]);
+    pCursor = new stim_cursor;
+  }
+  catch (const std::exception& e)
+  {
+    handle->sError = e.what();
+    return NULL;
+  }
+
+  pCursor->pHandle = handle;
+  pCursor->pSnapshot = NULL;
+  pCursor->pCursor = NULL;
+  pCursor->bMore = false;
+  if (BeginReport(pCursor, now, daterange, vTaskPaths) < 0)
+  {
+    stim_report_close(pCursor);
+    return NULL;
+  }
+
+  return pCursor;
+}
+
+
+extern "C" int stim_report_next(stim_cursor* cursor, stim_chunk_t* chunk)
+{
+  if (!cursor->bMore)
+    return 0;
+
+  stim_handle* pHandle = cursor->pHandle;
+  STIM_GUARD(pHandle,
+    cursor->bMore = cursor->pCursor->ReadChunk(cursor->tChunk, true));
+  if (!cursor->bMore)
+    return 0;
+
+  chunk->start_time = cursor->tChunk.aStartTime;
+  chunk->stop_time = cursor->tChunk.aStopTime;
+  chunk->task_path = cursor->tChunk.sTaskPath.c_str();
+  chunk->log_count = cursor->tChunk.vLogMessages.size();
+  return 1;
+}
+
+
+extern "C" int stim_report_log(
+    stim_cursor* cursor,
+    size_t index,
+    stim_log_entry_t* entry)
+{
+  if (index >= cursor->tChunk.vLogMessages.size())
+    return 0;
+
+  const TLogEntry& tEntry = cursor->tChunk.vLogMessages[index];
+  entry->log_time = tEntry.aLogTime;
+  entry->message = tEntry.sLogMessage.c_str();
+  return 1;
+}
+
+
+extern "C" void stim_report_close(stim_cursor* cursor)
+{
+  if (cursor == NULL)
+    return;
+
+  delete cursor->pCursor;
+  delete cursor->pSnapshot;
+  delete cursor;
+}
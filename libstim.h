@@ -0,0 +1,92 @@
+#ifndef _LIBSTIM_H_
+#define _LIBSTIM_H_
+
+/*
+ * libstim - C interface to the Stim engine, for hosts that want to query and
+ * record time without running the stim executable.
+ *
+ * A handle is bound to one contract and may be kept open for the life of
+ * the host.  Handles share nothing, so different threads may use different
+ * handles, but a single handle and its cursors must not be used by more
+ * than one thread at a time.  Strings returned by the library belong to
+ * the handle or cursor they came from and are valid until its next call.
+ *
+ * Functions returning int return 1 on success (or when there are results),
+ * 0 when there is nothing to report, and -1 on error, in which case
+ * stim_last_error() describes what went wrong.
+ */
+
+#include <stddef.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STIM_ABI_VERSION 1
+
+typedef struct stim_handle stim_handle;
+typedef struct stim_cursor stim_cursor;
+
+/* mirrors TSessionStatus */
+typedef struct
+{
+  time_t session_time;      /* session time excluding current work period */
+  time_t task_time;         /* task time for session excluding current work */
+  time_t transition_time;   /* start time of current work period */
+  const char* current_task; /* current task or last task worked on */
+  int running;              /* whether timer is currently running */
+} stim_status_t;
+
+/* one chunk of time spent on a task */
+typedef struct
+{
+  time_t start_time;
+  time_t stop_time;
+  const char* task_path;
+  size_t log_count;         /* log messages, see stim_report_log() */
+} stim_chunk_t;
+
+typedef struct
+{
+  time_t log_time;
+  const char* message;
+} stim_log_entry_t;
+
+int stim_abi_version(void);
+
+/* handles */
+stim_handle* stim_open(const char* home, const char* contract);
+void stim_close(stim_handle* handle);
+const char* stim_last_error(stim_handle* handle);
+
+/* create the home directory and contract log if they don't exist */
+int stim_init(stim_handle* handle);
+
+/* recording */
+int stim_start(stim_handle* handle, time_t when, const char* task);
+int stim_stop(stim_handle* handle, time_t when);
+int stim_log(stim_handle* handle, time_t when, const char* message);
+
+/* querying */
+int stim_status(stim_handle* handle, time_t now, stim_status_t* status);
+
+/* Report cursors walk the chunks of a date range as understood by
+ * "stim report", optionally limited to the given task paths.  Each cursor
+ * works on a snapshot of the log taken when it was opened, so records added
+ * meanwhile don't disturb it, and a handle may have several open. */
+stim_cursor* stim_report_open(
+    stim_handle* handle,
+    time_t now,
+    const char* daterange,
+    const char* const* task_paths,
+    size_t task_path_count);
+int stim_report_next(stim_cursor* cursor, stim_chunk_t* chunk);
+int stim_report_log(stim_cursor* cursor, size_t index, stim_log_entry_t* entry);
+void stim_report_close(stim_cursor* cursor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LIBSTIM_H_ */
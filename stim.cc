@@ -10,7 +10,19 @@
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <algorithm>
 #include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <dirent.h>
+#include <errno.h>
+#include <utime.h>
 using std::vector;
 
 
@@ -96,27 +108,6 @@ vector<string> split(const string& sSplittee, char cSplitter)
 }
 
 
-bool ReadNextLine(fstream& fTextFile, string& sLine)
-{
-    // create line buffer and read next line into it
-    std::stringbuf sLineBuffer;
-    fTextFile.get(sLineBuffer);
-
-    // load string with string contents of line buffer
-    sLine = sLineBuffer.str();
-
-    // current character is either a newline, or EOF
-    if (fTextFile.peek() != EOF)
-    {
-        // advance input stream past newline
-        fTextFile.seekg(sizeof(char), ios::cur);
-    }
-
-    // return whether there's any more data
-    return (fTextFile.peek() != EOF);
-}
-
-
 void SecondsToHms(int iSeconds, string& sHms)
 {
     // break down seconds into hours, minutes, seconds
@@ -137,16 +128,17 @@ void SecondsToHms(int iSeconds, string& sHms)
 void GkMakeTimestamp(time_t aTime, char* szDate)
 {
     // convert to struct we can examine
-    struct tm* pTm = localtime(&aTime); 
+    struct tm tTm;
+    localtime_r(&aTime, &tTm); 
     
     // build time string in the format "20041027 00:26:23"
     sprintf(szDate,"%4d%02d%02d %02d:%02d:%02d", 
-            pTm->tm_year + 1900,
-            pTm->tm_mon + 1,
-            pTm->tm_mday,
-            pTm->tm_hour,
-            pTm->tm_min,
-            pTm->tm_sec);
+            tTm.tm_year + 1900,
+            tTm.tm_mon + 1,
+            tTm.tm_mday,
+            tTm.tm_hour,
+            tTm.tm_min,
+            tTm.tm_sec);
 }
 
 
@@ -194,11 +186,29 @@ Stim::Stim(const char* szStimName, const char* szContract)
 
     // determine file names
     m_sStimLog = m_sStimDir + "/" + m_sContract + ".log";
+    m_sSessionIndex = m_sStimDir + "/" + m_sContract + ".sessions";
+    m_sQuarantine = m_sStimDir + "/" + m_sContract + ".quarantine";
+    m_bChecksums = false;
+    m_sTaskDictionary = m_sStimDir + "/" + m_sContract + ".tasks";
+    m_sDayIndex = m_sStimDir + "/" + m_sContract + ".days";
+    m_sVerified = m_sStimDir + "/" + m_sContract + ".verified";
+    m_sBlockSums = m_sStimDir + "/" + m_sContract + ".blocks";
+    m_sSyncJournal = m_sStimDir + "/" + m_sContract + ".sync";
+    m_sCacheDir = m_sStimDir + "/cache";
+    m_iCacheLimit = 0;
+    m_eReadMode = STIM_READ_AUTO;
 
     // basic initialisation
-    m_bLogReadOnly = true;
+    m_pScanSnapshot = NULL;
+    m_pScanCursor = NULL;
+#ifdef DEBUG
+    m_bTrace = true;
+#else
+    m_bTrace = false;
+#endif
 
-    Stim::Trace(("Log file: " + m_sStimLog).c_str());
+    if (Tracing())
+        Trace(("Log file: " + m_sStimLog).c_str());
 }
 
 
@@ -218,24 +228,20 @@ void Stim::Initialise(void)
 
 void Stim::EnsureInitialised(void)
 {
-    Stim::Trace("Initialising Stim (trace on)");
+    Trace("Initialising Stim (trace on)");
+    m_tStats.Switch(STIM_PHASE_ENVIRONMENT);
 
     // ensure the home environment is set up
     EnsureStimEnvironment(m_sStimDir.c_str(), m_sStimLog.c_str());
-
-    // open the log document
-    m_fLog.open(m_sStimLog.c_str(), ios::in);
-    if (!m_fLog)
-        throw ("Failed to open log file: " + m_sStimLog).c_str();
-
-    // only opening for reads by default
-    m_bLogReadOnly = true;
 }
 
 
 void Stim::Destroy(void)
 {
-    Stim::Trace("Destroying Stim");
+    Trace("Destroying Stim");
+
+    // drop any scan in progress
+    EndChunkScan();
 
     // close log file
     m_fLog.close();
@@ -251,58 +257,231 @@ void Stim::WriteLog(
     // make sure containers are initialised
     this->EnsureInitialised();
 
-    // ensure log is open in read/write
-    if (m_bLogReadOnly)
+    // ensure log is open for writing, making good any damage left by a
+    // crash first; reads go through snapshots
+    if (!m_fLog.is_open())
     {
-        // TODO: would be nice if there was a better way to do this
-        // TODO: verify open worked
-        m_fLog.close();
+        RecoverTail();
         m_fLog.clear();
         m_fLog.open(m_sStimLog.c_str(), ios::in | ios::out);
-        m_bLogReadOnly = false;
+        if (!m_fLog)
+            throw "Failed to open log file: " + m_sStimLog;
     }
 
-    // record event to log file
-    m_fLog.seekp(0, ios::end);
-    m_fLog << sTimestamp << " " << sEvent;
+    // record event to log file in one go, so that a crash can only ever
+    // tear the last record
+    string sLine = sTimestamp + " " + sEvent;
     if (sDetail.length() > 0)
-        m_fLog << " " << sDetail;
-    m_fLog << endl;
+        sLine += " " + sDetail;
+    if (m_bChecksums)
+    {
+        char szChecksum[STIM_CHECKSUM_LENGTH + 1];
+        snprintf(szChecksum, sizeof(szChecksum), "\t#%08lx", 
+            StimChecksum(sLine.data(), sLine.length()));
+        sLine += szChecksum;
+    }
+    sLine += '\n';
+    m_fLog.seekp(0, ios::end);
+    m_fLog.write(sLine.data(), sLine.length());
+    m_fLog.flush();
+}
+
+
+// Write what the log holds up to iKeep, followed by the given records, to
+// a new file and rename it into place, as vacuum does, so that snapshots of
+// the old log are left alone; false if it can't be done.
+bool Stim::ReplaceLog(off_t iKeep, const string& sTail)
+{
+    int iFd = open(m_sStimLog.c_str(), O_RDONLY);
+    if (iFd < 0)
+        return false;
+    string sTemp = m_sStimLog + ".tmp";
+    FILE* pOut = fopen(sTemp.c_str(), "w");
+    if (pOut == NULL)
+    {
+        close(iFd);
+        return false;
+    }
+    struct stat tStat;
+    bool bWritten = (fstat(iFd, &tStat) == 0);
+    char acBuffer[65536];
+    off_t iOffset = 0;
+    while (bWritten && iOffset < iKeep)
+    {
+        size_t iWant = min((off_t) sizeof(acBuffer), iKeep - iOffset);
+        ssize_t iGot = pread(iFd, acBuffer, iWant, iOffset);
+        bWritten = (iGot > 0 && fwrite(acBuffer, 1, iGot, pOut) == (size_t) iGot);
+        iOffset += iGot;
+    }
+    close(iFd);
+    bWritten = bWritten 
+        && fwrite(sTail.data(), 1, sTail.size(), pOut) == sTail.size()
+        && fflush(pOut) == 0 && fsync(fileno(pOut)) == 0;
+    if (fclose(pOut) != 0 || !bWritten)
+    {
+        unlink(sTemp.c_str());
+        return false;
+    }
+
+    chmod(sTemp.c_str(), tStat.st_mode & 07777);
+    if (rename(sTemp.c_str(), m_sStimLog.c_str()) != 0)
+    {
+        unlink(sTemp.c_str());
+        return false;
+    }
+    int iDir = open(m_sStimDir.c_str(), O_RDONLY);
+    if (iDir >= 0)
+    {
+        fsync(iDir);
+        close(iDir);
+    }
+
+    // any open handle is on the old log
+    m_fLog.close();
+    return true;
 }
 
 
-bool Stim::ReadLog(
-    string& sTimestamp, 
-    string& sEvent, 
-    string& sDetail)
+// Look over the end of the log for records torn by a crash mid-write and
+// move them aside to <contract>.quarantine.  Records are written whole, so
+// only the tail needs checking: lines there that are unterminated or fail
+// their checksum are taken off, as long as nothing good follows them, by
+// putting a copy of the log without them in its place.  An unterminated
+// last line that is otherwise a good record may well be a hand edit, so
+// unless records are being checksummed it is just given its newline.
+void Stim::RecoverTail(void)
 {
-    Stim::Trace("Beginning of ReadLog");
+    // a sync cut short comes first, as the log it left is whole but short
+    FinishSync();
+
+    int iFd = open(m_sStimLog.c_str(), O_RDWR);
+    if (iFd < 0)
+        return;
+    struct stat tStat;
+    if (fstat(iFd, &tStat) != 0 || tStat.st_size == 0)
+    {
+        close(iFd);
+        return;
+    }
+
+    // read the last block, or more if that's all one line
+    off_t iBlock = 4096, iFrom;
+    string sTail;
+    while (true)
+    {
+        iFrom = tStat.st_size > iBlock ? tStat.st_size - iBlock : 0;
+        sTail.resize(tStat.st_size - iFrom);
+        if (pread(iFd, &sTail[0], sTail.size(), iFrom) != (ssize_t) sTail.size())
+        {
+            close(iFd);
+            return;
+        }
+        if (iFrom == 0 || sTail.find('\n') < sTail.size() - 1)
+            break;
+        iBlock *= 2;
+    }
 
-    // read next line
-    string sLogLine; 
-    bool bMoreData = ReadNextLine(this->m_fLog, sLogLine);
+    // the block probably starts part way through a line
+    size_t iPos = 0;
+    if (iFrom > 0)
+        iPos = sTail.find('\n') + 1;
 
-    // parse out timestamp
-    sTimestamp = sLogLine.substr(0, 17);
+    // find where the damage at the end, if any, begins
+    size_t iDamage = string::npos;
+    bool bNeedsNewline = false;
+    while (iPos < sTail.size())
+    {
+        size_t iEol = sTail.find('\n', iPos);
+        bool bTerminated = (iEol != string::npos);
+        size_t iLength = (bTerminated ? iEol : sTail.size()) - iPos;
+
+        // a record is only as good as its checksum, if it has one
+        TLogLine tLine;
+        tLine.pText = sTail.data() + iPos;
+        tLine.iLength = iLength;
+        tLine.iOffset = iFrom + iPos;
+        size_t iRecordLength = iLength;
+        int iChecksum = CheckChecksum(tLine.pText, iRecordLength);
+        bool bDamaged = (iChecksum < 0 
+            || memchr(tLine.pText, 0, iLength) != NULL);
+        if (!bTerminated && !bDamaged)
+        {
+            TLogRecord tRecord;
+            bDamaged = !DecodeRecord(tLine, tRecord, false) 
+                || (m_bChecksums && iChecksum == 0);
+            bNeedsNewline = !bDamaged;
+        }
 
-    // parse out event
-    int iEndOfEvent = sLogLine.find_first_of(' ', 18);
-    int iEventLength = iEndOfEvent - 18;
-    sEvent = sLogLine.substr(18, iEventLength);
+        if (!bDamaged)
+            iDamage = string::npos;
+        else if (iDamage == string::npos)
+            iDamage = iPos;
 
-    // the rest is detail
-    sDetail = sLogLine.substr(iEndOfEvent + 1);
+        iPos += iLength + 1;
+    }
 
-    Stim::Trace("Leaving ReadLog");
+    if (iDamage == string::npos)
+    {
+        if (bNeedsNewline && pwrite(iFd, "\n", 1, tStat.st_size) != 1)
+            Trace("Failed to terminate last record");
+        close(iFd);
+        return;
+    }
 
-    return bMoreData;
+    // keep what's taken off, in case it's wanted after all; if it can't be
+    // kept, leave it be, as readers will skip it anyway
+    Trace("Quarantining damaged records at end of log");
+    FILE* pQuarantine = fopen(m_sQuarantine.c_str(), "a");
+    if (pQuarantine == NULL)
+    {
+        close(iFd);
+        return;
+    }
+    off_t iOffset = iFrom + iDamage;
+    fprintf(pQuarantine, "# %lld bytes from offset %lld of %s\n",
+        (long long) (tStat.st_size - iOffset), (long long) iOffset, 
+        m_sStimLog.c_str());
+    fwrite(sTail.data() + iDamage, 1, sTail.size() - iDamage, pQuarantine);
+    if (sTail[sTail.size() - 1] != '\n')
+        fputc('\n', pQuarantine);
+    close(iFd);
+    if (fclose(pQuarantine) != 0)
+        Trace("Failed to quarantine damaged records");
+    else if (!ReplaceLog(iOffset, ""))
+        Trace("Failed to cut damaged records from log");
+    else
+    {
+        TruncateBlockSums(tStat.st_ino, iOffset);
+        TruncateVerified(tStat.st_ino, iOffset);
+    }
 }
 
+
 void Stim::StartTask(time_t aStartTime, const string& sTaskPath)
 {
     char szDate[18];
     GkMakeTimestamp(aStartTime, szDate);
+    NoteSessionStart(aStartTime);
     WriteLog(szDate, STIM_TASK_START, sTaskPath);
+
+    // nothing to maintain until there's a dictionary or a day index;
+    // Tasks() and ActiveDays() build them
+    bool bTasks = access(m_sTaskDictionary.c_str(), W_OK) == 0;
+    bool bDays = access(m_sDayIndex.c_str(), W_OK) == 0;
+    if (bTasks || bDays)
+    {
+        StimSnapshot tSnapshot(m_sStimLog);
+        if (bTasks)
+        {
+            vector<TTaskUse> vTasks;
+            UpdateTaskDictionary(tSnapshot, vTasks);
+        }
+        if (bDays)
+        {
+            map<string, StimDaySet> vDays;
+            UpdateDayIndex(tSnapshot, vDays);
+        }
+    }
 }
 
 
@@ -353,13 +532,15 @@ int stringcmpi(const string& s1, const string& s2)
 time_t DetermineStartOfDay(time_t aTime)
 {
     // convert to struct we can examine
-    struct tm* pTm = localtime(&aTime); 
+    struct tm tTm;
+    localtime_r(&aTime, &tTm); 
     
     // clear out hour, minute, second
-    pTm->tm_hour = pTm->tm_min = pTm->tm_sec = 0;
+    tTm.tm_hour = tTm.tm_min = tTm.tm_sec = 0;
+    tTm.tm_isdst = -1;
 
     // convert back into timestamp
-    time_t aMidnight = mktime(pTm);
+    time_t aMidnight = mktime(&tTm);
     if (aMidnight < -1)
         throw "mktime() returned -1";
 
@@ -381,6 +562,7 @@ time_t DetermineStartOfDay(const string& sDate)
     tTm.tm_mday = iDay;
     tTm.tm_mon = (iMonth - 1);
     tTm.tm_year = (iYear - 1900);
+    tTm.tm_isdst = -1;
 /*    struct tm tTm = 
     { 
         0, 0, 0, 
@@ -404,92 +586,224 @@ bool stringtrim(string& s)
 }
 
 
-void DeterminePeriod(
-    time_t tNow,
-    const string& sDateRange, 
-    time_t& aPeriodStart, 
-    time_t& aPeriodEnd)
+static const struct
+{
+    const char* szName;
+    TStimBucket eBucket;
+} s_aBucketNames[] =
+{
+    { "day", STIM_BUCKET_DAY },
+    { "week", STIM_BUCKET_WEEK },
+    { "month", STIM_BUCKET_MONTH },
+    { "quarter", STIM_BUCKET_QUARTER },
+    { "year", STIM_BUCKET_YEAR },
+    { NULL, STIM_BUCKET_DAY }
+};
+
+
+bool ParseBucket(const string& sName, TStimBucket& eBucket)
 {
-    if (stringcmpi(sDateRange, STIM_DATE_TODAY) == 0)
+    for (int i = 0; s_aBucketNames[i].szName != NULL; i++)
     {
-        aPeriodStart = DetermineStartOfDay(tNow);
-        aPeriodEnd = aPeriodStart + SECONDS_IN_DAY - 1;
+        if (stringcmpi(sName, s_aBucketNames[i].szName) == 0)
+        {
+            eBucket = s_aBucketNames[i].eBucket;
+            return true;
+        }
     }
-    else if (stringcmpi(sDateRange, STIM_DATE_YESTERDAY) == 0)
+    return false;
+}
+
+
+// Local midnight starting the day, week, month, quarter or year the given
+// time falls in.  mktime() does the calendar arithmetic, so days that are
+// not 24 hours long come out right.
+time_t StartOfBucket(time_t aTime, TStimBucket eBucket)
+{
+    struct tm tTm;
+    localtime_r(&aTime, &tTm);
+
+    switch (eBucket)
     {
-        aPeriodStart = DetermineStartOfDay(tNow - SECONDS_IN_DAY);
-        aPeriodEnd = aPeriodStart + SECONDS_IN_DAY - 1;        
+    case STIM_BUCKET_DAY:
+        break;
+    case STIM_BUCKET_WEEK:
+        tTm.tm_mday -= (tTm.tm_wday + 6) % 7;
+        break;
+    case STIM_BUCKET_MONTH:
+        tTm.tm_mday = 1;
+        break;
+    case STIM_BUCKET_QUARTER:
+        tTm.tm_mday = 1;
+        tTm.tm_mon -= tTm.tm_mon % 3;
+        break;
+    case STIM_BUCKET_YEAR:
+        tTm.tm_mday = 1;
+        tTm.tm_mon = 0;
+        break;
     }
-    else // format is "<date>", "-<date>", "<date>-", "<date1>-<date2>", or ""
-    {
-        int iDash = sDateRange.find('-');
-        if (iDash == string::npos)
-        {
-            // one day specified
-            aPeriodStart = DetermineStartOfDay(sDateRange);
-            aPeriodEnd = aPeriodStart + SECONDS_IN_DAY - 1;
-        }
-        else
-        {
-            // split into "<date1>-<date2>"
-            string sStart = sDateRange.substr(0, iDash);
-            string sEnd = sDateRange.substr(iDash + 1);
 
-            // if start specified
-            if (stringtrim(sStart))
-                aPeriodStart = DetermineStartOfDay(sStart);
-            else
-                aPeriodStart = 0;
+    tTm.tm_hour = tTm.tm_min = tTm.tm_sec = 0;
+    tTm.tm_isdst = -1;
+    time_t aStart = mktime(&tTm);
+    if (aStart == -1)
+        throw "mktime() returned -1";
+    return aStart;
+}
 
-            // if end specified
-            if (stringtrim(sEnd))
-                aPeriodEnd = DetermineStartOfDay(sEnd) + SECONDS_IN_DAY - 1;
-            else
-                aPeriodEnd = tNow;
-        }
+
+// start of the bucket after the one starting at the given time
+time_t NextBucket(time_t aStart, TStimBucket eBucket)
+{
+    struct tm tTm;
+    localtime_r(&aStart, &tTm);
+
+    switch (eBucket)
+    {
+    case STIM_BUCKET_DAY:
+        tTm.tm_mday += 1;
+        break;
+    case STIM_BUCKET_WEEK:
+        tTm.tm_mday += 7;
+        break;
+    case STIM_BUCKET_MONTH:
+        tTm.tm_mon += 1;
+        break;
+    case STIM_BUCKET_QUARTER:
+        tTm.tm_mon += 3;
+        break;
+    case STIM_BUCKET_YEAR:
+        tTm.tm_year += 1;
+        break;
     }
+
+    tTm.tm_hour = tTm.tm_min = tTm.tm_sec = 0;
+    tTm.tm_isdst = -1;
+    time_t aNext = mktime(&tTm);
+    if (aNext == -1)
+        throw "mktime() returned -1";
+    return aNext;
 }
 
 
-bool Stim::FindPeriodStart(time_t aPeriodStart, time_t aPeriodEnd)
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar, with
+// no time zone involved, so day numbers from log timestamps need no mktime().
+long DayNumber(int iYear, int iMonth, int iDay)
 {
-    // seek to beginning of log file
-    this->m_fLog.seekg(0, ios::beg);
+    iYear -= iMonth <= 2;
+    long iEra = (iYear >= 0 ? iYear : iYear - 399) / 400;
+    long iYearOfEra = iYear - iEra * 400;
+    long iDayOfYear = (153 * (iMonth + (iMonth > 2 ? -3 : 9)) + 2) / 5 + iDay - 1;
+    long iDayOfEra = iYearOfEra * 365 + iYearOfEra / 4 - iYearOfEra / 100 + iDayOfYear;
+    return iEra * 146097 + iDayOfEra - 719468;
+}
 
-    // and here we have a linear search, folks
-    string sTimestamp, sEvent, sDetail;
-    time_t aTime;
-    bool bMoreLog = true;
-    while (bMoreLog)
+
+// the date of a day number, the other way round from DayNumber()
+void DayDate(long iDayNumber, int& iYear, int& iMonth, int& iDay)
+{
+    iDayNumber += 719468;
+    long iEra = (iDayNumber >= 0 ? iDayNumber : iDayNumber - 146096) / 146097;
+    long iDayOfEra = iDayNumber - iEra * 146097;
+    long iYearOfEra = (iDayOfEra - iDayOfEra / 1460 + iDayOfEra / 36524 
+        - iDayOfEra / 146096) / 365;
+    long iDayOfYear = iDayOfEra - (365 * iYearOfEra + iYearOfEra / 4 - iYearOfEra / 100);
+    long iMonthIndex = (5 * iDayOfYear + 2) / 153;
+    iDay = iDayOfYear - (153 * iMonthIndex + 2) / 5 + 1;
+    iMonth = iMonthIndex < 10 ? iMonthIndex + 3 : iMonthIndex - 9;
+    iYear = iYearOfEra + iEra * 400 + (iMonth <= 2);
+}
+
+
+// local midnight starting a day number
+time_t DayStart(long iDayNumber)
+{
+    struct tm tTm;
+    memset(&tTm, 0, sizeof(tTm));
+    DayDate(iDayNumber, tTm.tm_year, tTm.tm_mon, tTm.tm_mday);
+    tTm.tm_year -= 1900;
+    tTm.tm_mon -= 1;
+    tTm.tm_isdst = -1;
+    time_t aStart = mktime(&tTm);
+    if (aStart == -1)
+        throw "mktime() returned -1";
+    return aStart;
+}
+
+
+// "today" and "yesterday", or "this" or "last" and a bucket name, as the
+// bucket holding now or the one before it
+static bool DetermineNamedPeriod(
+    time_t tNow,
+    const string& sName,
+    time_t& aPeriodStart, 
+    time_t& aPeriodEnd)
+{
+    TStimBucket eBucket;
+    time_t aWithin = tNow;
+    if (stringcmpi(sName, STIM_DATE_TODAY) == 0)
+        eBucket = STIM_BUCKET_DAY;
+    else if (stringcmpi(sName, STIM_DATE_YESTERDAY) == 0)
     {
-        // get next line
-        streampos tLogPos = this->m_fLog.tellg();      
-        bMoreLog = ReadLog(sTimestamp, sEvent, sDetail);
+        eBucket = STIM_BUCKET_DAY;
+        aWithin = StartOfBucket(tNow, eBucket) - 1;
+    }
+    else if (stringcmpi(sName.substr(0, 4), STIM_DATE_THIS) == 0
+        && ParseBucket(sName.substr(4), eBucket))
+        ;
+    else if (stringcmpi(sName.substr(0, 4), STIM_DATE_LAST) == 0
+        && ParseBucket(sName.substr(4), eBucket))
+        aWithin = StartOfBucket(tNow, eBucket) - 1;
+    else
+        return false;
 
-        // compare timestamp and that it's a START event, not left over from
-        // last session
-        GkGrokTimestamp(aTime, sTimestamp.c_str());
-        if (aTime >= aPeriodStart && sEvent == STIM_TASK_START)
-        {
-            // check that we haven't overshot
-            if (aTime >= aPeriodEnd)
-                return false;
-            
-            // rewind to beginning of record
-            this->m_fLog.clear(); // this is necessary to reset the eof bit
-            this->m_fLog.seekg(tLogPos);
+    aPeriodStart = StartOfBucket(aWithin, eBucket);
+    aPeriodEnd = NextBucket(aPeriodStart, eBucket) - 1;
+    return true;
+}
 
-            return true;            
-        }
+
+void DeterminePeriod(
+    time_t tNow,
+    const string& sDateRange, 
+    time_t& aPeriodStart, 
+    time_t& aPeriodEnd)
+{
+    if (DetermineNamedPeriod(tNow, sDateRange, aPeriodStart, aPeriodEnd))
+        return;
+
+    // format is "<date>", "-<date>", "<date>-", "<date1>-<date2>", or ""
+    int iDash = sDateRange.find('-');
+    if (iDash == string::npos)
+    {
+        // one day specified
+        aPeriodStart = DetermineStartOfDay(sDateRange);
+        aPeriodEnd = NextBucket(aPeriodStart, STIM_BUCKET_DAY) - 1;
     }
+    else
+    {
+        // split into "<date1>-<date2>"
+        string sStart = sDateRange.substr(0, iDash);
+        string sEnd = sDateRange.substr(iDash + 1);
 
-    return false;
+        // if start specified
+        if (stringtrim(sStart))
+            aPeriodStart = DetermineStartOfDay(sStart);
+        else
+            aPeriodStart = 0;
+
+        // if end specified
+        if (stringtrim(sEnd))
+            aPeriodEnd = NextBucket(DetermineStartOfDay(sEnd), STIM_BUCKET_DAY) - 1;
+        else
+            aPeriodEnd = tNow;
+    }
 }
 
 
 void AddToTaskTotals(
     map<string, time_t>& vPeriodTime, 
-    string sTask, 
+    const string& sTask, 
     time_t tTimeSpent)
 {
     map<string, time_t>::iterator it;
@@ -502,6 +816,25 @@ void AddToTaskTotals(
 }
 
 
+// whether task is one of the given task paths or falls beneath one of them;
+// no task paths at all means every task matches
+bool TaskPathMatches(const vector<string>& vTaskPaths, const string& sTask)
+{
+    if (vTaskPaths.empty())
+        return true;
+
+    vector<string>::const_iterator it;
+    for (it = vTaskPaths.begin(); it != vTaskPaths.end(); it++)
+    {
+        if (sTask.compare(0, it->length(), *it) == 0
+            && (sTask.length() == it->length() || sTask[it->length()] == '/'))
+            return true;
+    }
+
+    return false;
+}
+
+
 time_t GetTotalTime(map<string, time_t>& vTaskTime)
 {
     map<string, time_t>::iterator it;
@@ -539,218 +872,4271 @@ void PrintOutTotals(const string& sStart, map<string, time_t>& vTaskTime)
 }
 
 
-bool Stim::Status(time_t tNow, TSessionStatus& tSession)
-{
-    // make sure containers are initialised
-    this->EnsureInitialised();
+// -----------------------------------------------------------------------
+//                                                               REPORTS
+// -----------------------------------------------------------------------
 
-    // determine period for reporting
-    string sDateRange = "today";
-    time_t aPeriodStart, aPeriodEnd;
-    DeterminePeriod(tNow, sDateRange, aPeriodStart, aPeriodEnd);
 
-    // seek to beginning of range
-    /* TODO: this should seek to beginning of session; it currently seeks
-     * to first entry of today.  Consider working late and starting a new 
-     * session at 11:45.  Work starts on a new task at 1:40 in the morning,
-     * but it's still the same session.  Status will report only on the
-     * later task.
-     */
-    Stim::Trace("Seeking to beginning of range");
-    if (!FindPeriodStart(aPeriodStart, aPeriodEnd))
-        return false;
-    Stim::Trace("Found beginning of range.");
-
-    // parse line by line
-    string sLogLine;
-    time_t tLastTime = STIM_TIME_NOTIME;
-    string sLastTask;
+// first block; each after is twice the last, up to the most
+#define STIM_ARENA_BLOCK (16 * 1024)
+#define STIM_ARENA_MAX_BLOCK (1024 * 1024)
 
-    map<string, time_t> vSessionTime;
-    string sSessionStartDate = ""; 
-    string sTimestamp, sEvent, sDetail;
-    bool bContinue = true;
-    bool bRunning = false;
-    while (bContinue)
-    {
-        Stim::Trace("here we are... about to read a log line...");
 
-        // read the next record
-        bContinue = ReadLog(sTimestamp, sEvent, sDetail);
+StimArena::StimArena(void)
+{
+    m_iBlock = 0;
+    m_iUsed = 0;
+}
 
-        if (bContinue)
-          Stim::Trace("finished reading log line (more to follow)");
-        else
-          Stim::Trace("finished reading log line (that's it)");
 
-        // trace the line
-        Stim::Trace(("LOG>" 
-            + sTimestamp + " > " + sEvent + " > " + sDetail).c_str());
+StimArena::~StimArena(void)
+{
+    for (size_t i = 0; i < m_vBlocks.size(); i++)
+        free(m_vBlocks[i].first);
+}
 
-        // skip log messages
-        if (sEvent == STIM_TASK_LOG)
-          continue;
 
-        // parse timestamp
-        time_t tTimeStamp;
-        GkGrokTimestamp(tTimeStamp, sTimestamp.c_str());
+const char* StimArena::Copy(const char* pText, size_t iLength)
+{
+    // move on through blocks kept from before until one has room
+    size_t iNeed = iLength + 1;
+    while (m_iBlock < m_vBlocks.size() 
+        && m_iUsed + iNeed > m_vBlocks[m_iBlock].second)
+    {
+        m_iBlock++;
+        m_iUsed = 0;
+    }
 
-        // if starting a new session
-        if (!bRunning)
-        {
-          // if this is the first entry of a new day, it must be a start event
-          // or FindStartOfDay wouldn't have started here
-          tLastTime = tTimeStamp;
-          sLastTask = sDetail;
-          bRunning = true;
+    if (m_iBlock == m_vBlocks.size())
+    {
+        size_t iSize = m_vBlocks.empty() ? STIM_ARENA_BLOCK 
+            : m_vBlocks.back().second * 2;
+        if (iSize > STIM_ARENA_MAX_BLOCK)
+            iSize = STIM_ARENA_MAX_BLOCK;
+        if (iSize < iNeed)
+            iSize = iNeed;
+        char* pBlock = (char*) malloc(iSize);
+        if (pBlock == NULL)
+            throw "Out of memory for report";
+        m_vBlocks.push_back(make_pair(pBlock, iSize));
+        m_iUsed = 0;
+    }
 
-          // status report doesn't distinguish between sessions, so there is
-          // nothing to report: just go on to next task
-        }
+    char* pCopy = m_vBlocks[m_iBlock].first + m_iUsed;
+    memcpy(pCopy, pText, iLength);
+    pCopy[iLength] = '\0';
+    m_iUsed += iNeed;
+    return pCopy;
+}
 
-        // otherwise, was working on a task, done with it for now
-        else
-        {
-          // calculate time difference
-          time_t tTimeDiff = tTimeStamp - tLastTime;
 
-          // add to task totals
-          AddToTaskTotals(vSessionTime, sLastTask, tTimeDiff);
+TArenaMark StimArena::Mark(void) const
+{
+    TArenaMark tMark;
+    tMark.iBlock = m_iBlock;
+    tMark.iUsed = m_iUsed;
+    return tMark;
+}
 
-          // starting or stopping?
-          if (sEvent == STIM_TASK_START)
-          { 
-            Stim::Trace("Starting new task");
-            bRunning = true;
 
-            // this task becomes the previous task
-            sLastTask = sDetail;
-          }
-          else if (sEvent == STIM_TASK_STOP)
-          {
-            Stim::Trace("Stopping task");
+void StimArena::Release(const TArenaMark& tMark)
+{
+    m_iBlock = tMark.iBlock;
+    m_iUsed = tMark.iUsed;
+}
 
-            // for next time: there is no previous task
-            //tLastTime = STIM_TIME_NOTIME;
 
-            // if it were true, you'd better catch it
-            bRunning = false;
-          }
+void StimArena::Clear(void)
+{
+    m_iBlock = 0;
+    m_iUsed = 0;
+}
 
-          // this is the start time of the current time chunk
-          tLastTime = tTimeStamp;
-        }
-    }
 
-    // determine total session time, excluding current task
-    time_t tTotalTime = 0;
-    if (!vSessionTime.empty())
-    {
-        tTotalTime = GetTotalTime(vSessionTime);
-    }
+void StimArena::Swap(StimArena& tOther)
+{
+    m_vBlocks.swap(tOther.m_vBlocks);
+    std::swap(m_iBlock, tOther.m_iBlock);
+    std::swap(m_iUsed, tOther.m_iUsed);
+}
 
-    // fill out struct
-    tSession.aSessionTime = tTotalTime;
-    tSession.aTaskTime = vSessionTime[sLastTask];
-    tSession.aTransitionTime = tLastTime;
-    tSession.sCurrentTask = sLastTask;
-    tSession.bRunning = bRunning;
 
-    return true;
+void StimReport::BeginChunk(time_t aStartTime, const char* pTaskPath, size_t iLength)
+{
+    m_tChunkMark = m_tArena.Mark();
+
+    TReportChunk tChunk;
+    tChunk.aStartTime = aStartTime;
+    tChunk.aStopTime = STIM_TIME_NOTIME;
+    tChunk.szTaskPath = m_tArena.Copy(pTaskPath, iLength);
+    tChunk.iTaskPathLength = iLength;
+    tChunk.iFirstLog = m_vLogs.size();
+    tChunk.iLogCount = 0;
+    m_vChunks.push_back(tChunk);
 }
 
 
-bool Stim::ReportTime(
-  time_t tNow,
-  const string& sDateRange, 
-  vector<string>& vTaskPaths,
-  TTimeSpent& vTimeSpent)
+void StimReport::AddLog(time_t aLogTime, const char* pMessage, size_t iLength)
 {
-    // make sure containers are initialised
-    this->EnsureInitialised();
-
-    // determine period for reporting
-    time_t aPeriodStart, aPeriodEnd;
-    DeterminePeriod(tNow, sDateRange, aPeriodStart, aPeriodEnd);
+    TReportLog tLog;
+    tLog.aLogTime = aLogTime;
+    tLog.szMessage = m_tArena.Copy(pMessage, iLength);
+    tLog.iMessageLength = iLength;
+    m_vLogs.push_back(tLog);
+    m_vChunks.back().iLogCount++;
+}
 
-    // seek to beginning of range
-    if (!FindPeriodStart(aPeriodStart, aPeriodEnd))
-        return false;
 
-    // parse line by line
-    string sLogLine;
-    time_t tLastTime = STIM_TIME_NOTIME;
-    string sLastTask;
+void StimReport::DropChunk(void)
+{
+    m_vLogs.resize(m_vChunks.back().iFirstLog);
+    m_vChunks.pop_back();
+    m_tArena.Release(m_tChunkMark);
+}
 
-    map<string, time_t> vSessionTime, vPeriodTime;
-    string sSessionStartDate = "";
-    string sTimestamp, sEvent, sDetail;
-    bool bContinue = true;
-    TTimeChunk tCurrentTimeChunk;
-    while (bContinue)
-    {
-        // read the next record
-        bContinue = ReadLog(sTimestamp, sEvent, sDetail);
 
-        // trace the line
-        Stim::Trace(("LOG>" 
-            + sTimestamp + " > " + sEvent + " > " + sDetail).c_str());
+// The messages of chunks dropped from the front stay where they are; the
+// report is about to be thrown away in any case.
+void StimReport::KeepLast(size_t iChunks)
+{
+    if (m_vChunks.size() > iChunks)
+        m_vChunks.erase(m_vChunks.begin(), m_vChunks.end() - iChunks);
+}
 
-        // parse timestamp
-        time_t tTimeStamp;
-        GkGrokTimestamp(tTimeStamp, sTimestamp.c_str());
 
-        // if new chunk of time
-        if (tCurrentTimeChunk.aStartTime == STIM_TIME_NOTIME)
+void StimReport::Append(const StimReport& tOther)
+{
+    for (size_t i = 0; i < tOther.Size(); i++)
+    {
+        const TReportChunk& tChunk = tOther[i];
+        BeginChunk(tChunk.aStartTime, tChunk.szTaskPath, tChunk.iTaskPathLength);
+        for (size_t j = 0; j < tChunk.iLogCount; j++)
         {
-          // check if this is outside of period bounds
-          if (tTimeStamp > aPeriodEnd)
-            break;
+            const TReportLog& tLog = tOther.Log(tChunk, j);
+            AddLog(tLog.aLogTime, tLog.szMessage, tLog.iMessageLength);
+        }
+        EndChunk(tChunk.aStopTime);
+    }
+}
+
+
+void StimReport::Clear(void)
+{
+    m_vChunks.clear();
+    m_vLogs.clear();
+    m_tArena.Clear();
+}
+
+
+void StimReport::Swap(StimReport& tOther)
+{
+    m_vChunks.swap(tOther.m_vChunks);
+    m_vLogs.swap(tOther.m_vLogs);
+    m_tArena.Swap(tOther.m_tArena);
+    std::swap(m_tChunkMark, tOther.m_tChunkMark);
+}
+
+
+void StimChunkColumns::Add(
+    time_t aStartTime, 
+    time_t aStopTime, 
+    const char* pTaskPath, 
+    size_t iLength)
+{
+    m_vStart.push_back(aStartTime);
+    m_vStop.push_back(aStopTime);
+    m_vTask.push_back(Intern(pTaskPath, iLength));
+}
+
+
+unsigned StimChunkColumns::Intern(const char* pTaskPath, size_t iLength)
+{
+    // FNV-1a
+    unsigned iHash = 2166136261u;
+    for (size_t i = 0; i < iLength; i++)
+        iHash = (iHash ^ (unsigned char) pTaskPath[i]) * 16777619u;
+
+    // look along from the task's slot for it or a free one, keeping the
+    // table no more than half full
+    if (m_vSlots.size() < 2 * (m_vTaskPaths.size() + 1))
+    {
+        vector<unsigned> vSlots(m_vSlots.empty() ? 64 : 2 * m_vSlots.size(), 0);
+        m_vSlots.swap(vSlots);
+        for (size_t i = 0; i < m_vTaskPaths.size(); i++)
+        {
+            unsigned iRehash = 2166136261u;
+            for (size_t j = 0; j < m_vTaskPaths[i].size(); j++)
+                iRehash = (iRehash ^ (unsigned char) m_vTaskPaths[i][j]) * 16777619u;
+            size_t iSlot = iRehash & (m_vSlots.size() - 1);
+            while (m_vSlots[iSlot] != 0)
+                iSlot = (iSlot + 1) & (m_vSlots.size() - 1);
+            m_vSlots[iSlot] = i + 1;
+        }
+    }
+
+    size_t iSlot = iHash & (m_vSlots.size() - 1);
+    while (m_vSlots[iSlot] != 0)
+    {
+        const string& sTaskPath = m_vTaskPaths[m_vSlots[iSlot] - 1];
+        if (sTaskPath.size() == iLength 
+            && memcmp(sTaskPath.data(), pTaskPath, iLength) == 0)
+            return m_vSlots[iSlot] - 1;
+        iSlot = (iSlot + 1) & (m_vSlots.size() - 1);
+    }
+
+    m_vTaskPaths.push_back(string(pTaskPath, iLength));
+    m_vSlots[iSlot] = m_vTaskPaths.size();
+    return m_vTaskPaths.size() - 1;
+}
+
+
+void StimChunkColumns::Clip(time_t aEnd)
+{
+    time_t* pStop = m_vStop.empty() ? NULL : &m_vStop[0];
+    for (size_t i = 0, iSize = m_vStop.size(); i < iSize; i++)
+        pStop[i] = pStop[i] < aEnd ? pStop[i] : aEnd;
+}
+
+
+void StimChunkColumns::Span(time_t& aFirst, time_t& aLast) const
+{
+    aFirst = STIM_TIME_FOREVER;
+    aLast = STIM_TIME_NOTIME;
+    for (size_t i = 0, iSize = m_vStart.size(); i < iSize; i++)
+    {
+        aFirst = m_vStart[i] < aFirst ? m_vStart[i] : aFirst;
+        aLast = m_vStop[i] > aLast ? m_vStop[i] : aLast;
+    }
+}
+
+
+void StimChunkColumns::AddTotals(vector<time_t>& vTaskTime) const
+{
+    if (vTaskTime.size() < m_vTaskPaths.size())
+        vTaskTime.resize(m_vTaskPaths.size(), 0);
+
+    // a gather and a scatter by task number, and nothing else
+    time_t* pTotal = vTaskTime.empty() ? NULL : &vTaskTime[0];
+    for (size_t i = 0, iSize = m_vStart.size(); i < iSize; i++)
+        pTotal[m_vTask[i]] += m_vStop[i] - m_vStart[i];
+}
+
+
+void StimChunkColumns::BucketTotals(
+    const vector<time_t>& vBounds, 
+    vector<time_t>& vTaskTime) const
+{
+    vTaskTime.clear();
+    if (vBounds.size() < 2)
+        return;
+    size_t iBuckets = vBounds.size() - 1;
+    size_t iTasks = m_vTaskPaths.size();
+    vTaskTime.assign(iBuckets * iTasks, 0);
+
+    size_t iBucket = 0;
+    for (size_t i = 0, iSize = m_vStart.size(); i < iSize; i++)
+    {
+        time_t aStart = max(m_vStart[i], vBounds[0]);
+        time_t aStop = min(m_vStop[i], vBounds[iBuckets]);
+        if (aStart >= aStop)
+            continue;
+
+        // chunks come in order, so the bucket is usually the last one or
+        // the next
+        if (aStart < vBounds[iBucket])
+            iBucket = upper_bound(vBounds.begin(), vBounds.end(), aStart) 
+                - vBounds.begin() - 1;
+        while (aStart >= vBounds[iBucket + 1])
+            iBucket++;
+
+        while (true)
+        {
+            time_t aSplit = min(aStop, vBounds[iBucket + 1]);
+            vTaskTime[iBucket * iTasks + m_vTask[i]] += aSplit - aStart;
+            aStart = aSplit;
+            if (aStart >= aStop)
+                break;
+            iBucket++;
+        }
+    }
+}
+
+
+void StimChunkColumns::Clear(void)
+{
+    m_vStart.clear();
+    m_vStop.clear();
+    m_vTask.clear();
+}
+
+
+// -----------------------------------------------------------------------
+//                                                            STATISTICS
+// -----------------------------------------------------------------------
+
+
+TQuantileSketch::TQuantileSketch(void)
+{
+    iCount = 0;
+    memset(aiBins, 0, sizeof(aiBins));
+}
+
+
+// Bin i holds lengths above GROWTH^(i-1) and up to GROWTH^i seconds; the
+// first takes everything up to a second and the last everything too long.
+void TQuantileSketch::Add(time_t aLength)
+{
+    int iBin = 0;
+    if (aLength > 1)
+        iBin = (int) ceil(log((double) aLength) / log(STIM_SKETCH_GROWTH));
+    if (iBin >= STIM_SKETCH_BINS)
+        iBin = STIM_SKETCH_BINS - 1;
+
+    aiBins[iBin]++;
+    iCount++;
+}
+
+
+// The length below which the given fraction of chunks fall, as the middle
+// of the bin it lands in.
+time_t TQuantileSketch::Quantile(double dQuantile) const
+{
+    if (iCount == 0)
+        return 0;
+
+    unsigned long iRank = (unsigned long) (dQuantile * (iCount - 1));
+    unsigned long iSeen = 0;
+    int iBin = 0;
+    for (; iBin < STIM_SKETCH_BINS - 1; iBin++)
+    {
+        iSeen += aiBins[iBin];
+        if (iSeen > iRank)
+            break;
+    }
+
+    if (iBin == 0)
+        return 1;
+    double dUpper = pow(STIM_SKETCH_GROWTH, iBin);
+    return (time_t) (2 * dUpper / (1 + STIM_SKETCH_GROWTH) + 0.5);
+}
+
+
+const time_t TWorkStats::aLengthBounds[STIM_LENGTH_BINS] = 
+{
+    60, 5 * 60, 15 * 60, 30 * 60, 60 * 60, 2 * 60 * 60, 4 * 60 * 60, 
+    STIM_TIME_FOREVER
+};
+
+const unsigned long TWorkStats::aiSwitchBounds[STIM_SWITCH_BINS] = 
+{
+    0, 1, 3, 7, 15, 31, ULONG_MAX
+};
+
+
+TWorkStats::TWorkStats(void)
+{
+    iChunks = 0;
+    aTotal = 0;
+    memset(aiLengthChunks, 0, sizeof(aiLengthChunks));
+    memset(aaLengthTime, 0, sizeof(aaLengthTime));
+    memset(aaOccupancy, 0, sizeof(aaOccupancy));
+    iDays = 0;
+    iSwitches = 0;
+    memset(aiSwitchDays, 0, sizeof(aiSwitchDays));
+    m_iDay = -1;
+    m_iDaySwitches = 0;
+}
+
+
+void TWorkStats::Add(const TTimeChunk& tChunk)
+{
+    time_t aLength = tChunk.aStopTime - tChunk.aStartTime;
+    iChunks++;
+    aTotal += aLength;
+
+    int iBin = 0;
+    while (aLength >= aLengthBounds[iBin])
+        iBin++;
+    aiLengthChunks[iBin]++;
+    aaLengthTime[iBin] += aLength;
+
+    vTaskLengths[tChunk.sTaskPath].Add(aLength);
+
+    // spread the chunk over the local hours it covers
+    struct tm tLocal;
+    time_t aTime = tChunk.aStartTime;
+    localtime_r(&aTime, &tLocal);
+    int iDay = tLocal.tm_year * 366 + tLocal.tm_yday;
+    while (aTime < tChunk.aStopTime)
+    {
+        time_t aNext = aTime + 60 * 60 - tLocal.tm_min * 60 - tLocal.tm_sec;
+        if (aNext > tChunk.aStopTime)
+            aNext = tChunk.aStopTime;
+        aaOccupancy[tLocal.tm_wday][tLocal.tm_hour] += aNext - aTime;
+
+        aTime = aNext;
+        if (aTime < tChunk.aStopTime)
+            localtime_r(&aTime, &tLocal);
+    }
+
+    // a chunk belongs to the day it starts on, and switches task if the
+    // one before it that day was of another
+    if (iDay != m_iDay)
+    {
+        Finish();
+        m_iDay = iDay;
+    }
+    else if (tChunk.sTaskPath != m_sLastTask)
+        m_iDaySwitches++;
+    m_sLastTask = tChunk.sTaskPath;
+}
+
+
+void TWorkStats::Finish(void)
+{
+    if (m_iDay < 0)
+        return;
+
+    int iBin = 0;
+    while (m_iDaySwitches > aiSwitchBounds[iBin])
+        iBin++;
+    aiSwitchDays[iBin]++;
+    iDays++;
+    iSwitches += m_iDaySwitches;
+
+    m_iDay = -1;
+    m_iDaySwitches = 0;
+}
+
+
+// -----------------------------------------------------------------------
+//                                                             SNAPSHOTS
+// -----------------------------------------------------------------------
+
+
+StimSnapshot::StimSnapshot(const string& sLogFile)
+{
+    m_pData = NULL;
+    m_iSize = 0;
+    m_iVerified = 0;
+
+    m_iFd = open(sLogFile.c_str(), O_RDONLY);
+    if (m_iFd < 0)
+        throw "Failed to open log file: " + sLogFile;
+    if (fstat(m_iFd, &m_tStat) != 0)
+    {
+        close(m_iFd);
+        throw "Failed to examine log file: " + sLogFile;
+    }
+
+    // the mapping and the descriptor both hold on to the file as it is now
+    m_iSize = m_tStat.st_size;
+    if (m_iSize > 0)
+    {
+        void* pData = mmap(NULL, m_iSize, PROT_READ, MAP_PRIVATE, m_iFd, 0);
+        if (pData == MAP_FAILED)
+        {
+            close(m_iFd);
+            throw "Failed to map log file: " + sLogFile;
+        }
+        m_pData = (const char*) pData;
+    }
+}
+
+
+StimSnapshot::~StimSnapshot(void)
+{
+    if (m_pData != NULL)
+        munmap((void*) m_pData, m_iSize);
+    close(m_iFd);
+}
+
+
+// Sample the pages of the range with mincore(); only a long range isn't
+// checked in full, as its start says well enough how the rest will go.
+bool StimSnapshot::Resident(off_t iOffset, off_t iLength) const
+{
+    if (iOffset + iLength > m_iSize)
+        iLength = m_iSize - iOffset;
+    if (iLength <= 0)
+        return true;
+    if (iLength > STIM_PREFETCH_MIN)
+        iLength = STIM_PREFETCH_MIN;
+
+    off_t iPage = sysconf(_SC_PAGESIZE);
+    off_t iFirst = iOffset - iOffset % iPage;
+    size_t iPages = (iOffset + iLength - iFirst + iPage - 1) / iPage;
+    vector<unsigned char> vResident(iPages);
+    if (mincore((void*) (m_pData + iFirst), iOffset + iLength - iFirst, 
+        &vResident[0]) != 0)
+        return true;
+
+    size_t iCount = 0;
+    for (size_t i = 0; i < iPages; i++)
+        iCount += vResident[i] & 1;
+    return iCount * 10 >= iPages * 9;
+}
+
+
+off_t StimSnapshot::LineStartFrom(off_t iOffset) const
+{
+    if (iOffset <= 0)
+        return 0;
+    if (iOffset >= m_iSize)
+        return m_iSize;
+
+    // at the start of a line if the previous character ends one
+    const char* pNewline = (const char*) memchr(
+        m_pData + iOffset - 1, '\n', m_iSize - iOffset + 1);
+    if (pNewline == NULL)
+        return m_iSize;
+    return (pNewline - m_pData) + 1;
+}
+
+
+off_t StimSnapshot::LineStartBefore(off_t iOffset) const
+{
+    if (iOffset > m_iSize)
+        iOffset = m_iSize;
+    if (iOffset <= 0)
+        return 0;
+
+    // skip the newline ending the line we're after, then find the one before
+    off_t iSearch = iOffset;
+    if (m_pData[iSearch - 1] == '\n')
+        iSearch--;
+    const char* pNewline = (const char*) memrchr(m_pData, '\n', iSearch);
+    if (pNewline == NULL)
+        return 0;
+    return (pNewline - m_pData) + 1;
+}
+
+
+StimMappedLineReader::StimMappedLineReader(const StimSnapshot& tSnapshot)
+  : m_tSnapshot(tSnapshot)
+{
+    m_iPos = 0;
+    m_iEnd = tSnapshot.Size();
+}
+
+
+void StimMappedLineReader::Seek(off_t iOffset, off_t iEnd)
+{
+    m_iPos = iOffset;
+    m_iEnd = (iEnd < m_tSnapshot.Size()) ? iEnd : m_tSnapshot.Size();
+}
+
+
+bool StimMappedLineReader::NextLine(TLogLine& tLine)
+{
+    if (m_iPos >= m_iEnd)
+        return false;
+
+    const char* pStart = m_tSnapshot.Data() + m_iPos;
+    const char* pNewline = (const char*) memchr(pStart, '\n', m_iEnd - m_iPos);
+
+    tLine.pText = pStart;
+    tLine.iOffset = m_iPos;
+    if (pNewline == NULL)
+    {
+        // last line, missing its newline
+        tLine.iLength = m_iEnd - m_iPos;
+        m_iPos = m_iEnd;
+    }
+    else
+    {
+        tLine.iLength = pNewline - pStart;
+        m_iPos += tLine.iLength + 1;
+    }
+
+    return true;
+}
+
+
+StimReverseLineReader::StimReverseLineReader(const StimSnapshot& tSnapshot)
+  : m_tSnapshot(tSnapshot)
+{
+    m_iLow = 0;
+    m_iPos = tSnapshot.Size();
+}
+
+
+void StimReverseLineReader::Seek(off_t iOffset, off_t iEnd)
+{
+    m_iLow = iOffset;
+    m_iPos = (iEnd < m_tSnapshot.Size()) ? iEnd : m_tSnapshot.Size();
+}
+
+
+bool StimReverseLineReader::NextLine(TLogLine& tLine)
+{
+    if (m_iPos <= m_iLow)
+        return false;
+
+    off_t iStart = m_tSnapshot.LineStartBefore(m_iPos);
+    if (iStart < m_iLow)
+        iStart = m_iLow;
+
+    tLine.pText = m_tSnapshot.Data() + iStart;
+    tLine.iOffset = iStart;
+    tLine.iLength = m_iPos - iStart;
+    if (tLine.iLength > 0 && tLine.pText[tLine.iLength - 1] == '\n')
+        tLine.iLength--;
+
+    m_iPos = iStart;
+    return true;
+}
+
+
+StimPrefetchLineReader::StimPrefetchLineReader(
+    const StimSnapshot& tSnapshot, 
+    size_t iBufferSize)
+  : m_tSnapshot(tSnapshot)
+{
+    m_iBufferSize = iBufferSize;
+    m_iEnd = tSnapshot.Size();
+    pthread_mutex_init(&m_tLock, NULL);
+    pthread_cond_init(&m_tChanged, NULL);
+    m_bThread = false;
+    m_bStop = false;
+
+    // page aligned, as are the offsets read from
+    for (int i = 0; i < 2; i++)
+    {
+        void* pBuffer;
+        if (posix_memalign(&pBuffer, 4096, m_iBufferSize) != 0)
+            throw "Out of memory for read-ahead buffers";
+        m_apBuffer[i] = (char*) pBuffer;
+    }
+
+    Seek(0, m_iEnd);
+}
+
+
+StimPrefetchLineReader::~StimPrefetchLineReader(void)
+{
+    Stop();
+    free(m_apBuffer[0]);
+    free(m_apBuffer[1]);
+    pthread_cond_destroy(&m_tChanged);
+    pthread_mutex_destroy(&m_tLock);
+}
+
+
+// Nothing is read until the first line is asked for, as a seek is often
+// followed by another.
+void StimPrefetchLineReader::Seek(off_t iOffset, off_t iEnd)
+{
+    Stop();
+    m_iEnd = (iEnd < m_tSnapshot.Size()) ? iEnd : m_tSnapshot.Size();
+    m_iPos = iOffset;
+    m_iCurrent = -1;
+    m_bDone = false;
+    m_pPos = m_pLimit = NULL;
+    m_abReady[0] = m_abReady[1] = false;
+    m_iError = 0;
+}
+
+
+void StimPrefetchLineReader::Start(void)
+{
+    if (m_iPos >= m_iEnd)
+    {
+        m_bDone = true;
+        return;
+    }
+
+    m_iFillFrom = m_iPos - m_iPos % 4096;
+    m_iSkip = m_iPos - m_iFillFrom;
+    posix_fadvise(m_tSnapshot.Descriptor(), m_iFillFrom, 
+        m_iEnd - m_iFillFrom, POSIX_FADV_SEQUENTIAL);
+
+    m_bStop = false;
+    if (pthread_create(&m_tThread, NULL, Run, this) != 0)
+        throw "Failed to start read-ahead thread";
+    m_bThread = true;
+}
+
+
+void StimPrefetchLineReader::Stop(void)
+{
+    if (!m_bThread)
+        return;
+
+    pthread_mutex_lock(&m_tLock);
+    m_bStop = true;
+    pthread_cond_broadcast(&m_tChanged);
+    pthread_mutex_unlock(&m_tLock);
+
+    pthread_join(m_tThread, NULL);
+    m_bThread = false;
+}
+
+
+void* StimPrefetchLineReader::Run(void* pReader)
+{
+    ((StimPrefetchLineReader*) pReader)->Fill();
+    return NULL;
+}
+
+
+// The thread: fill each buffer in turn once it has been handed back, until
+// the end of the range.  An empty buffer marks the end, or an error.
+void StimPrefetchLineReader::Fill(void)
+{
+    int iFd = m_tSnapshot.Descriptor();
+    off_t iPos = m_iFillFrom;
+    for (int i = 0; ; i ^= 1)
+    {
+        pthread_mutex_lock(&m_tLock);
+        while (m_abReady[i] && !m_bStop)
+            pthread_cond_wait(&m_tChanged, &m_tLock);
+        bool bStop = m_bStop;
+        pthread_mutex_unlock(&m_tLock);
+        if (bStop)
+            return;
+
+        size_t iWant = m_iEnd - iPos;
+        if (iWant > m_iBufferSize)
+            iWant = m_iBufferSize;
+        size_t iGot = 0;
+        int iError = 0;
+        while (iGot < iWant)
+        {
+            ssize_t iRead = pread(iFd, m_apBuffer[i] + iGot, iWant - iGot, 
+                iPos + iGot);
+            if (iRead < 0 && errno == EINTR)
+                continue;
+            if (iRead <= 0)
+            {
+                // shorter than the snapshot says counts as an error too
+                iError = (iRead < 0) ? errno : EIO;
+                break;
+            }
+            iGot += iRead;
+        }
+
+        pthread_mutex_lock(&m_tLock);
+        m_aiFilled[i] = iError ? 0 : iGot;
+        m_iError = iError;
+        m_abReady[i] = true;
+        pthread_cond_broadcast(&m_tChanged);
+        pthread_mutex_unlock(&m_tLock);
+
+        if (iError || iGot == 0)
+            return;
+        iPos += iGot;
+    }
+}
+
+
+// Hand back the buffer just parsed and wait for the next; false at the end
+bool StimPrefetchLineReader::NextBuffer(void)
+{
+    if (m_bDone)
+        return false;
+
+    pthread_mutex_lock(&m_tLock);
+    if (m_iCurrent >= 0)
+    {
+        m_abReady[m_iCurrent] = false;
+        pthread_cond_broadcast(&m_tChanged);
+        m_iCurrent ^= 1;
+    }
+    else
+        m_iCurrent = 0;
+    while (!m_abReady[m_iCurrent])
+        pthread_cond_wait(&m_tChanged, &m_tLock);
+    size_t iFilled = m_aiFilled[m_iCurrent];
+    int iError = m_iError;
+    pthread_mutex_unlock(&m_tLock);
+
+    if (iError)
+    {
+        m_bDone = true;
+        throw string("Failed to read log file: ") + strerror(iError);
+    }
+    if (iFilled == 0)
+    {
+        m_bDone = true;
+        return false;
+    }
+
+    m_pPos = m_apBuffer[m_iCurrent] + m_iSkip;
+    m_pLimit = m_apBuffer[m_iCurrent] + iFilled;
+    m_iSkip = 0;
+    return true;
+}
+
+
+// Lines are found within a buffer where possible; one running over the end
+// of a buffer is stitched together from its pieces.
+bool StimPrefetchLineReader::NextLine(TLogLine& tLine)
+{
+    if (!m_bThread && !m_bDone)
+        Start();
+
+    bool bCarry = false;
+    m_sCarry.clear();
+    for (;;)
+    {
+        if (m_pPos == m_pLimit && !NextBuffer())
+        {
+            if (!bCarry)
+                return false;
+
+            // last line, missing its newline
+            tLine.pText = m_sCarry.data();
+            tLine.iLength = m_sCarry.size();
+            return true;
+        }
+
+        const char* pNewline = (const char*) memchr(
+            m_pPos, '\n', m_pLimit - m_pPos);
+        if (pNewline == NULL)
+        {
+            if (!bCarry)
+                tLine.iOffset = m_iPos;
+            bCarry = true;
+            m_sCarry.append(m_pPos, m_pLimit - m_pPos);
+            m_iPos += m_pLimit - m_pPos;
+            m_pPos = m_pLimit;
+            continue;
+        }
+
+        size_t iLength = pNewline - m_pPos;
+        if (bCarry)
+        {
+            m_sCarry.append(m_pPos, iLength);
+            tLine.pText = m_sCarry.data();
+            tLine.iLength = m_sCarry.size();
+        }
+        else
+        {
+            tLine.pText = m_pPos;
+            tLine.iLength = iLength;
+            tLine.iOffset = m_iPos;
+        }
+        m_iPos += iLength + 1;
+        m_pPos = pNewline + 1;
+        return true;
+    }
+}
+
+
+// -----------------------------------------------------------------------
+//                                                               CURSORS
+// -----------------------------------------------------------------------
+
+
+// shortest line that can hold a record: timestamp, space, event
+#define STIM_MIN_RECORD 19
+
+
+// CRC-32, as used by zlib and others; the table is the usual one for the
+// reversed polynomial 0xedb88320, fixed so that threads can share it
+static const unsigned long aiCrcTable[256] =
+{
+    0x00000000UL, 0x77073096UL, 0xee0e612cUL, 0x990951baUL, 0x076dc419UL,
+    0x706af48fUL, 0xe963a535UL, 0x9e6495a3UL, 0x0edb8832UL, 0x79dcb8a4UL,
+    0xe0d5e91eUL, 0x97d2d988UL, 0x09b64c2bUL, 0x7eb17cbdUL, 0xe7b82d07UL,
+    0x90bf1d91UL, 0x1db71064UL, 0x6ab020f2UL, 0xf3b97148UL, 0x84be41deUL,
+    0x1adad47dUL, 0x6ddde4ebUL, 0xf4d4b551UL, 0x83d385c7UL, 0x136c9856UL,
+    0x646ba8c0UL, 0xfd62f97aUL, 0x8a65c9ecUL, 0x14015c4fUL, 0x63066cd9UL,
+    0xfa0f3d63UL, 0x8d080df5UL, 0x3b6e20c8UL, 0x4c69105eUL, 0xd56041e4UL,
+    0xa2677172UL, 0x3c03e4d1UL, 0x4b04d447UL, 0xd20d85fdUL, 0xa50ab56bUL,
+    0x35b5a8faUL, 0x42b2986cUL, 0xdbbbc9d6UL, 0xacbcf940UL, 0x32d86ce3UL,
+    0x45df5c75UL, 0xdcd60dcfUL, 0xabd13d59UL, 0x26d930acUL, 0x51de003aUL,
+    0xc8d75180UL, 0xbfd06116UL, 0x21b4f4b5UL, 0x56b3c423UL, 0xcfba9599UL,
+    0xb8bda50fUL, 0x2802b89eUL, 0x5f058808UL, 0xc60cd9b2UL, 0xb10be924UL,
+    0x2f6f7c87UL, 0x58684c11UL, 0xc1611dabUL, 0xb6662d3dUL, 0x76dc4190UL,
+    0x01db7106UL, 0x98d220bcUL, 0xefd5102aUL, 0x71b18589UL, 0x06b6b51fUL,
+    0x9fbfe4a5UL, 0xe8b8d433UL, 0x7807c9a2UL, 0x0f00f934UL, 0x9609a88eUL,
+    0xe10e9818UL, 0x7f6a0dbbUL, 0x086d3d2dUL, 0x91646c97UL, 0xe6635c01UL,
+    0x6b6b51f4UL, 0x1c6c6162UL, 0x856530d8UL, 0xf262004eUL, 0x6c0695edUL,
+    0x1b01a57bUL, 0x8208f4c1UL, 0xf50fc457UL, 0x65b0d9c6UL, 0x12b7e950UL,
+    0x8bbeb8eaUL, 0xfcb9887cUL, 0x62dd1ddfUL, 0x15da2d49UL, 0x8cd37cf3UL,
+    0xfbd44c65UL, 0x4db26158UL, 0x3ab551ceUL, 0xa3bc0074UL, 0xd4bb30e2UL,
+    0x4adfa541UL, 0x3dd895d7UL, 0xa4d1c46dUL, 0xd3d6f4fbUL, 0x4369e96aUL,
+    0x346ed9fcUL, 0xad678846UL, 0xda60b8d0UL, 0x44042d73UL, 0x33031de5UL,
+    0xaa0a4c5fUL, 0xdd0d7cc9UL, 0x5005713cUL, 0x270241aaUL, 0xbe0b1010UL,
+    0xc90c2086UL, 0x5768b525UL, 0x206f85b3UL, 0xb966d409UL, 0xce61e49fUL,
+    0x5edef90eUL, 0x29d9c998UL, 0xb0d09822UL, 0xc7d7a8b4UL, 0x59b33d17UL,
+    0x2eb40d81UL, 0xb7bd5c3bUL, 0xc0ba6cadUL, 0xedb88320UL, 0x9abfb3b6UL,
+    0x03b6e20cUL, 0x74b1d29aUL, 0xead54739UL, 0x9dd277afUL, 0x04db2615UL,
+    0x73dc1683UL, 0xe3630b12UL, 0x94643b84UL, 0x0d6d6a3eUL, 0x7a6a5aa8UL,
+    0xe40ecf0bUL, 0x9309ff9dUL, 0x0a00ae27UL, 0x7d079eb1UL, 0xf00f9344UL,
+    0x8708a3d2UL, 0x1e01f268UL, 0x6906c2feUL, 0xf762575dUL, 0x806567cbUL,
+    0x196c3671UL, 0x6e6b06e7UL, 0xfed41b76UL, 0x89d32be0UL, 0x10da7a5aUL,
+    0x67dd4accUL, 0xf9b9df6fUL, 0x8ebeeff9UL, 0x17b7be43UL, 0x60b08ed5UL,
+    0xd6d6a3e8UL, 0xa1d1937eUL, 0x38d8c2c4UL, 0x4fdff252UL, 0xd1bb67f1UL,
+    0xa6bc5767UL, 0x3fb506ddUL, 0x48b2364bUL, 0xd80d2bdaUL, 0xaf0a1b4cUL,
+    0x36034af6UL, 0x41047a60UL, 0xdf60efc3UL, 0xa867df55UL, 0x316e8eefUL,
+    0x4669be79UL, 0xcb61b38cUL, 0xbc66831aUL, 0x256fd2a0UL, 0x5268e236UL,
+    0xcc0c7795UL, 0xbb0b4703UL, 0x220216b9UL, 0x5505262fUL, 0xc5ba3bbeUL,
+    0xb2bd0b28UL, 0x2bb45a92UL, 0x5cb36a04UL, 0xc2d7ffa7UL, 0xb5d0cf31UL,
+    0x2cd99e8bUL, 0x5bdeae1dUL, 0x9b64c2b0UL, 0xec63f226UL, 0x756aa39cUL,
+    0x026d930aUL, 0x9c0906a9UL, 0xeb0e363fUL, 0x72076785UL, 0x05005713UL,
+    0x95bf4a82UL, 0xe2b87a14UL, 0x7bb12baeUL, 0x0cb61b38UL, 0x92d28e9bUL,
+    0xe5d5be0dUL, 0x7cdcefb7UL, 0x0bdbdf21UL, 0x86d3d2d4UL, 0xf1d4e242UL,
+    0x68ddb3f8UL, 0x1fda836eUL, 0x81be16cdUL, 0xf6b9265bUL, 0x6fb077e1UL,
+    0x18b74777UL, 0x88085ae6UL, 0xff0f6a70UL, 0x66063bcaUL, 0x11010b5cUL,
+    0x8f659effUL, 0xf862ae69UL, 0x616bffd3UL, 0x166ccf45UL, 0xa00ae278UL,
+    0xd70dd2eeUL, 0x4e048354UL, 0x3903b3c2UL, 0xa7672661UL, 0xd06016f7UL,
+    0x4969474dUL, 0x3e6e77dbUL, 0xaed16a4aUL, 0xd9d65adcUL, 0x40df0b66UL,
+    0x37d83bf0UL, 0xa9bcae53UL, 0xdebb9ec5UL, 0x47b2cf7fUL, 0x30b5ffe9UL,
+    0xbdbdf21cUL, 0xcabac28aUL, 0x53b39330UL, 0x24b4a3a6UL, 0xbad03605UL,
+    0xcdd70693UL, 0x54de5729UL, 0x23d967bfUL, 0xb3667a2eUL, 0xc4614ab8UL,
+    0x5d681b02UL, 0x2a6f2b94UL, 0xb40bbe37UL, 0xc30c8ea1UL, 0x5a05df1bUL,
+    0x2d02ef8dUL
+};
+
+
+unsigned long StimChecksum(const char* pData, size_t iLength)
+{
+    unsigned long iCrc = 0xffffffffUL;
+    for (size_t i = 0; i < iLength; i++)
+        iCrc = aiCrcTable[(iCrc ^ (unsigned char) pData[i]) & 0xff] ^ (iCrc >> 8);
+    return iCrc ^ 0xffffffffUL;
+}
+
+
+// Check a record's checksum, if it has one, trimming it off the length.
+// Returns 1 if it matches, 0 if there is none and -1 if it doesn't match.
+int CheckChecksum(const char* pText, size_t& iLength)
+{
+    if (iLength < STIM_CHECKSUM_LENGTH + STIM_MIN_RECORD)
+        return 0;
+    const char* pSuffix = pText + iLength - STIM_CHECKSUM_LENGTH;
+    if (pSuffix[0] != '\t' || pSuffix[1] != '#')
+        return 0;
+
+    unsigned long iChecksum = 0;
+    for (int i = 2; i < STIM_CHECKSUM_LENGTH; i++)
+    {
+        char c = pSuffix[i];
+        if (c >= '0' && c <= '9')
+            iChecksum = (iChecksum << 4) | (c - '0');
+        else if (c >= 'a' && c <= 'f')
+            iChecksum = (iChecksum << 4) | (c - 'a' + 10);
+        else
+            return 0;
+    }
+
+    iLength -= STIM_CHECKSUM_LENGTH;
+    return StimChecksum(pText, iLength) == iChecksum ? 1 : -1;
+}
+
+
+// whether the text starts with a timestamp like "20041027 00:26:23" that
+// GkGrokTimestamp() can make sense of
+bool IsTimestamp(const char* pText)
+{
+    static const char szPattern[] = "00000000 00:00:00";
+    for (int i = 0; i < 17; i++)
+    {
+        if (szPattern[i] == '0' 
+            ? (pText[i] < '0' || pText[i] > '9') 
+            : pText[i] != szPattern[i])
+            return false;
+    }
+
+    // and no earlier than the epoch, give or take a time zone
+    return memcmp(pText, "1971", 4) >= 0;
+}
+
+
+// Split a timestamp into year, month, day, hour, minute and second, checking
+// its layout on the way; all 17 bytes must be readable.  With SSE2 the
+// bytes are checked all at once and the digit pairs converted side by side.
+static bool SplitTimestamp(const char* pText, int aiField[6])
+{
+#if defined(__SSE2__)
+    const __m128i vZero = _mm_set1_epi8('0');
+    const __m128i vSeparators = _mm_setr_epi8(
+        0, 0, 0, 0, 0, 0, 0, 0, ' ', 0, 0, ':', 0, 0, ':', 0);
+    const int iSeparators = (1 << 8) | (1 << 11) | (1 << 14);
+
+    // less '0', digits are no more than 9 taken as unsigned
+    __m128i vText = _mm_loadu_si128((const __m128i*) pText);
+    __m128i vDigits = _mm_sub_epi8(vText, vZero);
+    int iIsDigit = _mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_min_epu8(vDigits, _mm_set1_epi8(9)), vDigits));
+    int iIsSeparator = _mm_movemask_epi8(_mm_cmpeq_epi8(vText, vSeparators));
+    if ((iIsDigit | iSeparators) != 0xFFFF 
+        || (iIsSeparator & iSeparators) != iSeparators
+        || (unsigned char) (pText[16] - '0') > 9)
+        return false;
+
+    // tens times ten plus units for the pairs at even offsets, and again one
+    // byte along for the hour and second, which are at odd ones
+    const __m128i vTen = _mm_set1_epi16(10);
+    const __m128i vTens = _mm_set1_epi16(0x00FF);
+    __m128i vEven = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_and_si128(vDigits, vTens), vTen),
+        _mm_srli_epi16(vDigits, 8));
+    __m128i vDigits1 = _mm_sub_epi8(
+        _mm_loadu_si128((const __m128i*) (pText + 1)), vZero);
+    __m128i vOdd = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_and_si128(vDigits1, vTens), vTen),
+        _mm_srli_epi16(vDigits1, 8));
+
+    aiField[0] = _mm_extract_epi16(vEven, 0) * 100 + _mm_extract_epi16(vEven, 1);
+    aiField[1] = _mm_extract_epi16(vEven, 2);
+    aiField[2] = _mm_extract_epi16(vEven, 3);
+    aiField[3] = _mm_extract_epi16(vOdd, 4);
+    aiField[4] = _mm_extract_epi16(vEven, 6);
+    aiField[5] = _mm_extract_epi16(vOdd, 7);
+    return aiField[0] >= 1971;
+#else
+    if (!IsTimestamp(pText))
+        return false;
+
+    #define STIM_DIGITS2(i) ((pText[i] - '0') * 10 + (pText[i + 1] - '0'))
+    aiField[0] = STIM_DIGITS2(0) * 100 + STIM_DIGITS2(2);
+    aiField[1] = STIM_DIGITS2(4);
+    aiField[2] = STIM_DIGITS2(6);
+    aiField[3] = STIM_DIGITS2(9);
+    aiField[4] = STIM_DIGITS2(12);
+    aiField[5] = STIM_DIGITS2(15);
+    #undef STIM_DIGITS2
+    return true;
+#endif
+}
+
+
+// The local midnight of the day most recently decoded, per thread, since
+// records come a day at a time.  Days whose UTC offset changes aren't
+// steady, and their times are left to mktime().
+struct TStampDay
+{
+    int iDate;              // YYYYMMDD, or 0
+    time_t aMidnight;
+    bool bSteady;
+};
+
+static __thread TStampDay g_tStampDay;
+
+
+// Decode the timestamp at the start of the text as GkGrokTimestamp()
+// would; false if it isn't one.
+bool DecodeTimestamp(const char* pText, time_t& aTime)
+{
+    int aiField[6];
+    if (!SplitTimestamp(pText, aiField))
+        return false;
+
+    TStampDay& tDay = g_tStampDay;
+    int iDate = aiField[0] * 10000 + aiField[1] * 100 + aiField[2];
+    if (tDay.iDate != iDate)
+    {
+        // a change of offset makes the day longer or shorter; the day's own
+        // midnight comes last, as mktime() guesses the offset of times that
+        // happen twice or not at all from the one it last worked out
+        struct tm tTm;
+        memset(&tTm, 0, sizeof(tTm));
+        tTm.tm_year = aiField[0] - 1900;
+        tTm.tm_mon = aiField[1] - 1;
+        tTm.tm_mday = aiField[2] + 1;
+        tTm.tm_isdst = -1;
+        time_t aNextMidnight = mktime(&tTm);
+
+        memset(&tTm, 0, sizeof(tTm));
+        tTm.tm_year = aiField[0] - 1900;
+        tTm.tm_mon = aiField[1] - 1;
+        tTm.tm_mday = aiField[2];
+        tTm.tm_isdst = -1;
+        tDay.aMidnight = mktime(&tTm);
+
+        tDay.iDate = iDate;
+        tDay.bSteady = tDay.aMidnight != -1 
+            && aNextMidnight - tDay.aMidnight == SECONDS_IN_DAY;
+    }
+
+    if (tDay.bSteady && aiField[3] < 24 && aiField[4] < 60 && aiField[5] < 60)
+    {
+        aTime = tDay.aMidnight 
+            + aiField[3] * 3600 + aiField[4] * 60 + aiField[5];
+        return true;
+    }
+
+    char szTimestamp[18];
+    memcpy(szTimestamp, pText, 17);
+    szTimestamp[17] = 0;
+    GkGrokTimestamp(aTime, szTimestamp);
+    return true;
+}
+
+
+// split a log line into a record; false if it isn't one.  Lines already
+// verified have any checksum taken off without checking it.
+bool DecodeRecord(
+    const TLogLine& tLine, 
+    TLogRecord& tRecord, 
+    bool bLogDetail, 
+    bool bVerified)
+{
+    // timestamp is fixed width at the start of the line
+    if (tLine.iLength < STIM_MIN_RECORD || tLine.pText[17] != ' '
+        || !DecodeTimestamp(tLine.pText, tRecord.aTime))
+        return false;
+
+    // damaged records are skipped like any other garbage
+    size_t iLength = tLine.iLength;
+    if (bVerified)
+    {
+        if (iLength >= STIM_CHECKSUM_LENGTH + STIM_MIN_RECORD
+            && tLine.pText[iLength - STIM_CHECKSUM_LENGTH] == '\t'
+            && tLine.pText[iLength - STIM_CHECKSUM_LENGTH + 1] == '#')
+            iLength -= STIM_CHECKSUM_LENGTH;
+    }
+    else if (CheckChecksum(tLine.pText, iLength) < 0)
+        return false;
+
+    // event runs to the next space, if any; the rest is detail
+    const char* pEvent = tLine.pText + 18;
+    const char* pEnd = tLine.pText + iLength;
+    const char* pSpace = (const char*) memchr(pEvent, ' ', pEnd - pEvent);
+    size_t iEventLength = (pSpace ? pSpace : pEnd) - pEvent;
+
+    if (iEventLength == 5 && memcmp(pEvent, STIM_TASK_START, 5) == 0)
+        tRecord.eEvent = STIM_EVENT_START;
+    else if (iEventLength == 4 && memcmp(pEvent, STIM_TASK_STOP, 4) == 0)
+        tRecord.eEvent = STIM_EVENT_STOP;
+    else if (iEventLength == 3 && memcmp(pEvent, STIM_TASK_LOG, 3) == 0)
+        tRecord.eEvent = STIM_EVENT_LOG;
+    else
+        tRecord.eEvent = STIM_EVENT_UNKNOWN;
+
+    // log message bodies are left alone unless wanted
+    if (pSpace == NULL || (!bLogDetail && tRecord.eEvent == STIM_EVENT_LOG))
+    {
+        tRecord.pDetail = pEnd;
+        tRecord.iDetailLength = 0;
+    }
+    else
+    {
+        tRecord.pDetail = pSpace + 1;
+        tRecord.iDetailLength = pEnd - tRecord.pDetail;
+    }
+
+    tRecord.iOffset = tLine.iOffset;
+    return true;
+}
+
+
+StimCursor::StimCursor(
+    const StimSnapshot& tSnapshot, 
+    TStimStats* pStats, 
+    bool bTrace)
+  : m_tSnapshot(tSnapshot)
+{
+    m_pMappedReader = new StimMappedLineReader(tSnapshot);
+    m_pPrefetchReader = NULL;
+    m_pReader = m_pMappedReader;
+    m_eReadMode = STIM_READ_AUTO;
+    m_pStats = pStats ? pStats : &m_tOwnStats;
+    m_bTrace = bTrace;
+    m_bScanMore = false;
+    m_bScanClosed = false;
+    m_iScanPeriod = 0;
+}
+
+
+StimCursor::~StimCursor(void)
+{
+    delete m_pMappedReader;
+    delete m_pPrefetchReader;
+}
+
+
+// Long scans over pages not yet in memory read ahead on a thread of their
+// own; anything else reads straight from the mapping.
+void StimCursor::SeekScan(off_t iOffset)
+{
+    off_t iLength = m_tSnapshot.Size() - iOffset;
+    if (m_eReadMode == STIM_READ_PREFETCH
+        || (m_eReadMode == STIM_READ_AUTO && iLength >= STIM_PREFETCH_MIN
+            && !m_tSnapshot.Resident(iOffset, iLength)))
+    {
+        Trace("Reading ahead");
+        if (m_pPrefetchReader == NULL)
+            m_pPrefetchReader = new StimPrefetchLineReader(m_tSnapshot);
+        m_pReader = m_pPrefetchReader;
+    }
+    else
+        m_pReader = m_pMappedReader;
+
+    m_pReader->Seek(iOffset, m_tSnapshot.Size());
+}
+
+
+void StimCursor::Trace(const char* szMessage)
+{
+    if (m_bTrace)
+        cerr << "STIM>" << szMessage << endl;
+}
+
+
+void StimCursor::TraceRecord(const TLogRecord& tRecord)
+{
+    static const char* aszEvents[] = 
+        { STIM_TASK_START, STIM_TASK_STOP, STIM_TASK_LOG, "?" };
+
+    char szDate[18];
+    GkMakeTimestamp(tRecord.aTime, szDate);
+    cerr << "STIM>LOG>" << szDate << " > " << aszEvents[tRecord.eEvent] 
+         << " > " << string(tRecord.pDetail, tRecord.iDetailLength) << endl;
+}
+
+
+// Read and decode the next record, skipping blank and malformed lines
+bool StimCursor::ReadRecord(TLogRecord& tRecord, bool bLogDetail)
+{
+    TLogLine tLine;
+    while (m_pReader->NextLine(tLine))
+    {
+        m_pStats->iLines++;
+        m_pStats->iBytes += tLine.iLength + 1;
+        if (DecodeRecord(tLine, tRecord, bLogDetail, 
+                tLine.iOffset < m_tSnapshot.Verified()))
+        {
+            m_pStats->iRecords++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+// Bisect towards the first record no earlier than the given time.  The
+// offset returned is at or a little before that record; records before it
+// are all earlier, as long as the log is in time order there.
+off_t StimCursor::BisectTime(time_t aTarget, off_t iFrom)
+{
+    off_t iLow = iFrom, iHigh = m_tSnapshot.Size();
+    TLogRecord tRecord;
+    m_pReader = m_pMappedReader;
+    for (off_t iStep = 4096; iFrom > 0 && iHigh - iLow > iStep; iStep *= 2)
+    {
+        off_t iProbe = m_tSnapshot.LineStartFrom(iLow + iStep);
+        if (iProbe >= iHigh)
+            break;
+
+        m_pReader->Seek(iProbe, iHigh);
+        if (!ReadRecord(tRecord, false) || tRecord.aTime >= aTarget)
+        {
+            iHigh = iProbe;
+            break;
+        }
+        iLow = tRecord.iOffset;
+    }
+
+    while (iHigh - iLow > 4096)
+    {
+        off_t iMiddle = m_tSnapshot.LineStartFrom(iLow + (iHigh - iLow) / 2);
+        if (iMiddle >= iHigh)
+            break;
+
+        m_pReader->Seek(iMiddle, iHigh);
+        if (!ReadRecord(tRecord, false) || tRecord.aTime >= aTarget)
+            iHigh = iMiddle;
+        else
+            iLow = tRecord.iOffset;
+    }
+
+    return iLow;
+}
+
+
+// Position the cursor at the first START record in the given period.
+// The log is in time order, give or take hand edits and backdated
+// entries, so bisect to about a day before the period and walk from there.
+bool StimCursor::FindPeriodStart(time_t aPeriodStart, time_t aPeriodEnd)
+{
+    m_pStats->Switch(STIM_PHASE_SEEK);
+    off_t iLow = BisectTime(aPeriodStart - SECONDS_IN_DAY);
+
+    // and here we have a linear search, folks, but a short one
+    TLogRecord tRecord;
+    m_pReader->Seek(iLow, m_tSnapshot.Size());
+    while (ReadRecord(tRecord, false))
+    {
+        // compare timestamp and that it's a START event, not left over from
+        // last session
+        if (tRecord.aTime >= aPeriodStart && tRecord.eEvent == STIM_EVENT_START)
+        {
+            // check that we haven't overshot
+            if (tRecord.aTime >= aPeriodEnd)
+                return false;
+            
+            // rewind to beginning of record
+            SeekScan(tRecord.iOffset);
+            return true;            
+        }
+    }
+
+    return false;
+}
+
+
+bool StimCursor::Status(
+    time_t tNow, 
+    TSessionStatus& tSession, 
+    off_t iSessionStart)
+{
+    // determine period for reporting
+    string sDateRange = "today";
+    time_t aPeriodStart, aPeriodEnd;
+    DeterminePeriod(tNow, sDateRange, aPeriodStart, aPeriodEnd);
+
+    // seek to beginning of session, which may well have started yesterday;
+    // without a session index, make do with the first entry of today
+    if (iSessionStart >= 0)
+    {
+        m_pStats->Switch(STIM_PHASE_SEEK);
+        SeekScan(iSessionStart);
+    }
+    else
+    {
+        Trace("Seeking to beginning of range");
+        if (!FindPeriodStart(aPeriodStart, aPeriodEnd))
+            return false;
+        Trace("Found beginning of range.");
+    }
+
+    // add up the chunks, starting afresh with each new session; an index
+    // that's behind the log can leave us a session or two early
+    ResetChunkScan(STIM_TIME_FOREVER, vector<string>());
+    time_t tLastTime = STIM_TIME_NOTIME;
+    string sLastTask;
+    map<string, time_t> vSessionTime;
+    TTimeChunk tChunk;
+    while (ReadChunk(tChunk, false))
+    {
+        if (StartsNewSession(tLastTime, tChunk.aStartTime))
+            vSessionTime.clear();
+        AddToTaskTotals(vSessionTime, tChunk.sTaskPath, 
+            tChunk.aStopTime - tChunk.aStartTime);
+
+        // the end of this chunk is the last transition so far
+        tLastTime = tChunk.aStopTime;
+        sLastTask.swap(tChunk.sTaskPath);
+    }
+
+    // and then there's the chunk under way, if the timer is running
+    time_t aRunningStart;
+    string sRunningTask;
+    bool bRunning = RunningChunk(aRunningStart, sRunningTask);
+    if (bRunning)
+    {
+        if (StartsNewSession(tLastTime, aRunningStart))
+            vSessionTime.clear();
+        tLastTime = aRunningStart;
+        sLastTask.swap(sRunningTask);
+    }
+
+    // nothing at all, or a session that was over before today began
+    if (tLastTime == STIM_TIME_NOTIME 
+        || (!bRunning && tLastTime < aPeriodStart))
+        return false;
+
+    // determine total session time, excluding current task
+    time_t tTotalTime = 0;
+    if (!vSessionTime.empty())
+    {
+        tTotalTime = GetTotalTime(vSessionTime);
+    }
+
+    // fill out struct
+    tSession.aSessionTime = tTotalTime;
+    tSession.aTaskTime = vSessionTime[sLastTask];
+    tSession.aTransitionTime = tLastTime;
+    tSession.sCurrentTask = sLastTask;
+    tSession.bRunning = bRunning;
+
+    return true;
+}
+
+
+bool StimCursor::BeginChunkScan(
+    time_t tNow,
+    const string& sDateRange,
+    const vector<string>& vTaskPaths)
+{
+    // determine period for reporting
+    time_t aPeriodStart, aPeriodEnd;
+    DeterminePeriod(tNow, sDateRange, aPeriodStart, aPeriodEnd);
+    ResetChunkScan(aPeriodEnd, vTaskPaths);
+
+    // seek to beginning of range
+    m_bScanMore = FindPeriodStart(aPeriodStart, m_aScanEnd);
+    return m_bScanMore;
+}
+
+
+// Set up a chunk scan over the most recent chunks only: the last iChunks
+// chunks (if non-zero) or those since aSince (if not STIM_TIME_NOTIME),
+// whichever is fewer.  The log is read backwards from the end to find where
+// to start, so the cost depends on how far back that is, not on the size of
+// the log.  ReadChunk() may still return a few chunks more than asked for.
+bool StimCursor::BeginTailScan(
+    size_t iChunks,
+    time_t aSince,
+    const vector<string>& vTaskPaths)
+{
+    m_pStats->Switch(STIM_PHASE_SEEK);
+
+    // walk back over start records; the last one may still be running, so
+    // it takes one more than the number of chunks wanted
+    StimReverseLineReader tReader(m_tSnapshot);
+    TLogLine tLine;
+    TLogRecord tRecord;
+    size_t iStarts = 0;
+    off_t iScanStart = 0;
+    string sTask;
+    while (tReader.NextLine(tLine))
+    {
+        m_pStats->iLines++;
+        m_pStats->iBytes += tLine.iLength + 1;
+        if (!DecodeRecord(tLine, tRecord, false)
+            || tRecord.eEvent != STIM_EVENT_START)
+            continue;
+        m_pStats->iRecords++;
+
+        sTask.assign(tRecord.pDetail, tRecord.iDetailLength);
+        if (TaskPathMatches(vTaskPaths, sTask))
+            iStarts++;
+        if ((iChunks > 0 && iStarts > iChunks)
+            || (aSince != STIM_TIME_NOTIME && tRecord.aTime < aSince))
+        {
+            iScanStart = tRecord.iOffset;
+            break;
+        }
+    }
+
+    // then forwards as usual, to the end of the log
+    SeekScan(iScanStart);
+    ResetChunkScan(STIM_TIME_FOREVER, vTaskPaths);
+    return true;
+}
+
+
+void StimCursor::ResetChunkScan(time_t aScanEnd, const vector<string>& vTaskPaths)
+{
+    m_aScanStart = STIM_TIME_NOTIME;
+    m_vScanTasks = vTaskPaths;
+    m_iScanPeriod = 0;
+    m_aScanEnd = aScanEnd;
+    m_bScanMore = true;
+    m_bScanClosed = false;
+}
+
+
+void StimCursor::BeginScanChunk(const TLogRecord& tRecord)
+{
+    m_aScanStart = tRecord.aTime;
+    m_sScanTask.assign(tRecord.pDetail, tRecord.iDetailLength);
+    m_bScanWanted = TaskPathMatches(m_vScanTasks, m_sScanTask);
+}
+
+
+// Read the next complete chunk of time from the range set up by
+// BeginChunkScan() onto the end of the report.  Log messages are only
+// parsed and kept if bLogMessages is set.  A chunk still running at the end
+// of the log is not returned.
+bool StimCursor::ReadChunk(StimReport& tReport, bool bLogMessages)
+{
+    TLogRecord tRecord;
+    bool bBegun = false;
+    while (m_bScanMore)
+    {
+        // read the next record
+        m_pStats->Switch(STIM_PHASE_PARSE);
+        if (!ReadRecord(tRecord, bLogMessages))
+        {
+          m_bScanMore = false;
+          break;
+        }
+        m_pStats->Switch(STIM_PHASE_AGGREGATE);
+
+        // trace the line
+        if (Tracing())
+          TraceRecord(tRecord);
+
+        // between chunks, skip ahead to the next time one wanted might
+        // start, if that's far enough off to be worth seeking to
+        if (!m_vScanPeriods.empty() 
+            && (m_aScanStart == STIM_TIME_NOTIME || !m_bScanWanted))
+        {
+          while (m_iScanPeriod < m_vScanPeriods.size()
+              && tRecord.aTime >= m_vScanPeriods[m_iScanPeriod].second)
+            m_iScanPeriod++;
+          if (m_iScanPeriod == m_vScanPeriods.size())
+          {
+            m_bScanMore = false;
+            break;
+          }
+          if (m_vScanPeriods[m_iScanPeriod].first - tRecord.aTime >= STIM_DAYS_SKIP)
+          {
+            // bisecting leaves the mapping to read on with, as reading
+            // ahead would only be thrown away at the next skip
+            m_pStats->Switch(STIM_PHASE_SEEK);
+            off_t iSkip = BisectTime(
+                m_vScanPeriods[m_iScanPeriod].first, tRecord.iOffset);
+            if (iSkip > tRecord.iOffset)
+            {
+              m_aScanStart = STIM_TIME_NOTIME;
+              m_pReader->Seek(iSkip, m_tSnapshot.Size());
+              continue;
+            }
+            m_pReader->Seek(m_tSnapshot.LineStartFrom(tRecord.iOffset + 1), 
+                m_tSnapshot.Size());
+            m_pStats->Switch(STIM_PHASE_AGGREGATE);
+          }
+        }
+
+        // if new chunk of time
+        if (m_aScanStart == STIM_TIME_NOTIME)
+        {
+          // check if this is outside of period bounds
+          if (tRecord.aTime > m_aScanEnd)
+          {
+            m_bScanMore = false;
+            m_bScanClosed = true;
+            break;
+          }
+
+          // new time; new session?
+          if (tRecord.eEvent == STIM_EVENT_START)
+            BeginScanChunk(tRecord);
+        }
+
+        // are we logging something for the task?  Chunks that aren't
+        // wanted are passed over without keeping anything
+        else if (tRecord.eEvent == STIM_EVENT_LOG)
+        {
+          if (bLogMessages && m_bScanWanted)
+          {
+            if (!bBegun)
+              tReport.BeginChunk(m_aScanStart, m_sScanTask.data(), m_sScanTask.size());
+            bBegun = true;
+            tReport.AddLog(tRecord.aTime, tRecord.pDetail, tRecord.iDetailLength);
+          }
+        }
+
+        // assume we're stopping (or starting a new task)
+        else
+        {
+          bool bWanted = m_bScanWanted;
+          if (bWanted)
+          {
+            if (!bBegun)
+              tReport.BeginChunk(m_aScanStart, m_sScanTask.data(), m_sScanTask.size());
+            tReport.EndChunk(tRecord.aTime);
+          }
+
+          if (tRecord.eEvent == STIM_EVENT_START)
+            BeginScanChunk(tRecord);
+          else
+            m_aScanStart = STIM_TIME_NOTIME;
+
+          if (bWanted)
+            return true;
+        }
+    }
+
+    if (bBegun)
+        tReport.DropChunk();
+    return false;
+}
+
+
+// As above, onto the end of the columns, without log messages
+bool StimCursor::ReadChunk(StimChunkColumns& tColumns)
+{
+    m_tScanReport.Clear();
+    if (!ReadChunk(m_tScanReport, false))
+        return false;
+
+    const TReportChunk& tFound = m_tScanReport[0];
+    tColumns.Add(tFound.aStartTime, tFound.aStopTime, 
+        tFound.szTaskPath, tFound.iTaskPathLength);
+    return true;
+}
+
+
+bool StimCursor::RunningChunk(time_t& aStartTime, string& sTaskPath) const
+{
+    if (m_bScanMore || m_aScanStart == STIM_TIME_NOTIME || !m_bScanWanted)
+        return false;
+
+    aStartTime = m_aScanStart;
+    sTaskPath = m_sScanTask;
+    return true;
+}
+
+
+// As above, a chunk at a time for callers wanting one of their own
+bool StimCursor::ReadChunk(TTimeChunk& tChunk, bool bLogMessages)
+{
+    m_tScanReport.Clear();
+    if (!ReadChunk(m_tScanReport, bLogMessages))
+        return false;
+
+    // strings and messages already there are reused
+    const TReportChunk& tFound = m_tScanReport[0];
+    tChunk.aStartTime = tFound.aStartTime;
+    tChunk.aStopTime = tFound.aStopTime;
+    tChunk.sTaskPath.assign(tFound.szTaskPath, tFound.iTaskPathLength);
+    tChunk.vLogMessages.resize(tFound.iLogCount);
+    for (size_t i = 0; i < tFound.iLogCount; i++)
+    {
+        const TReportLog& tLog = m_tScanReport.Log(tFound, i);
+        tChunk.vLogMessages[i].aLogTime = tLog.aLogTime;
+        tChunk.vLogMessages[i].sLogMessage.assign(tLog.szMessage, tLog.iMessageLength);
+    }
+    return true;
+}
+
+
+bool StimCursor::ReportTime(
+  time_t tNow,
+  const string& sDateRange, 
+  const vector<string>& vTaskPaths,
+  StimReport& tReport)
+{
+    // seek to beginning of range
+    if (!BeginChunkScan(tNow, sDateRange, vTaskPaths))
+        return false;
+
+    // collect chunks, log messages and all
+    while (ReadChunk(tReport, true))
+        ;
+
+    // check if we've logged time
+    return !tReport.Empty();
+}
+
+
+// Like ReportTime(), but for the most recent chunks; see BeginTailScan()
+bool StimCursor::ReportRecent(
+  size_t iChunks,
+  time_t aSince,
+  const vector<string>& vTaskPaths,
+  StimReport& tReport)
+{
+    BeginTailScan(iChunks, aSince, vTaskPaths);
+
+    // collect chunks ending since the given time
+    while (ReadChunk(tReport, true))
+    {
+        if (aSince != STIM_TIME_NOTIME 
+            && tReport[tReport.Size() - 1].aStopTime <= aSince)
+            tReport.DropChunk();
+    }
+
+    // keep only as many as were asked for
+    if (iChunks > 0)
+        tReport.KeepLast(iChunks);
+
+    return !tReport.Empty();
+}
+
+
+// Like ReportTime(), but only accumulates the time spent per task: no chunks
+// are kept and log messages are never parsed.
+bool StimCursor::ReportTotals(
+  time_t tNow,
+  const string& sDateRange, 
+  const vector<string>& vTaskPaths,
+  map<string, time_t>& vTaskTime)
+{
+    // seek to beginning of range
+    if (!BeginChunkScan(tNow, sDateRange, vTaskPaths))
+        return false;
+
+    // add up chunks a batch at a time as they go by, into totals by task
+    // number, and only then by name
+    StimChunkColumns tColumns;
+    vector<time_t> vTotals;
+    bool bMore = true;
+    while (bMore)
+    {
+        tColumns.Clear();
+        while ((bMore = ReadChunk(tColumns)) && tColumns.Size() < STIM_COLUMN_BATCH)
+            ;
+        tColumns.AddTotals(vTotals);
+    }
+
+    for (size_t i = 0; i < tColumns.Tasks(); i++)
+        AddToTaskTotals(vTaskTime, tColumns.TaskPath(i), vTotals[i]);
+    return tColumns.Tasks() > 0;
+}
+
+
+// Like ReportTotals(), but keeps totals for each day, week, month, quarter
+// or year of the period in one pass.  Chunks crossing from one bucket into
+// the next are split between them, and any part past the end of the period
+// is left out.  Only buckets with time in them are returned.
+bool StimCursor::ReportBuckets(
+  time_t tNow,
+  const string& sDateRange, 
+  const vector<string>& vTaskPaths,
+  TStimBucket eBucket,
+  vector<TBucketTotals>& vBuckets)
+{
+    time_t aPeriodStart, aPeriodEnd;
+    DeterminePeriod(tNow, sDateRange, aPeriodStart, aPeriodEnd);
+    if (!BeginChunkScan(tNow, sDateRange, vTaskPaths))
+        return false;
+
+    StimChunkColumns tColumns;
+    vector<time_t> vBounds;
+    vector<time_t> vTotals;
+    size_t iFirst = vBuckets.size();
+    bool bMore = true;
+    while (bMore)
+    {
+        tColumns.Clear();
+        while ((bMore = ReadChunk(tColumns)) && tColumns.Size() < STIM_COLUMN_BATCH)
+            ;
+        tColumns.Clip(aPeriodEnd + 1);
+
+        // the buckets from the first start in the batch to the last stop,
+        // none of them more than the period
+        time_t aFirst, aLast;
+        tColumns.Span(aFirst, aLast);
+        if (aFirst >= aLast)
+            continue;
+        vBounds.clear();
+        vBounds.push_back(StartOfBucket(aFirst, eBucket));
+        while (vBounds.back() < aLast)
+            vBounds.push_back(NextBucket(vBounds.back(), eBucket));
+        tColumns.BucketTotals(vBounds, vTotals);
+
+        // then on to those with time in them, by name
+        for (size_t iBucket = 0; iBucket + 1 < vBounds.size(); iBucket++)
+        {
+            const time_t* pRow = &vTotals[iBucket * tColumns.Tasks()];
+            for (size_t iTask = 0; iTask < tColumns.Tasks(); iTask++)
+            {
+                if (pRow[iTask] == 0)
+                    continue;
+
+                // a bucket may carry on from the last batch
+                if (vBuckets.size() == iFirst 
+                    || vBounds[iBucket] >= vBuckets.back().aStopTime)
+                {
+                    vBuckets.push_back(TBucketTotals());
+                    TBucketTotals& tBucket = vBuckets.back();
+                    tBucket.aStartTime = max(vBounds[iBucket], aPeriodStart);
+                    tBucket.aStopTime = min(vBounds[iBucket + 1], aPeriodEnd + 1);
+                }
+                AddToTaskTotals(vBuckets.back().vTaskTime, 
+                    tColumns.TaskPath(iTask), pRow[iTask]);
+            }
+        }
+    }
+
+    return vBuckets.size() > iFirst;
+}
+
+
+// Like ReportTotals(), but gathers how the time was spread about: by chunk
+// length, time of day, task switches and per-task chunk length.  Chunks go
+// by one at a time, so a period of any length takes the same memory.
+bool StimCursor::WorkStats(
+  time_t tNow,
+  const string& sDateRange, 
+  const vector<string>& vTaskPaths,
+  TWorkStats& tStats)
+{
+    if (!BeginChunkScan(tNow, sDateRange, vTaskPaths))
+        return false;
+
+    TTimeChunk tChunk;
+    while (ReadChunk(tChunk, false))
+        tStats.Add(tChunk);
+    tStats.Finish();
+
+    return tStats.iChunks > 0;
+}
+
+
+// orders indices of point-in-time queries by the time asked about
+struct TTaskAtOrder
+{
+    const vector<TTaskAt>& m_vQueries;
+
+    TTaskAtOrder(const vector<TTaskAt>& vQueries) : m_vQueries(vQueries) {}
+
+    bool operator()(size_t i, size_t j) const
+    {
+        return m_vQueries[i].aWhen < m_vQueries[j].aWhen;
+    }
+};
+
+
+// Find the chunk of work going on at each of the given moments.  Queries are
+// taken in time order and merged against the log in a single pass, so a
+// batch costs one seek and a read of the stretch of log it spans rather than
+// a seek per query.  A moment at which one chunk ends and another begins
+// belongs to the later one.  Returns whether anything was running at any of
+// the moments.
+bool StimCursor::TasksAt(vector<TTaskAt>& vQueries)
+{
+    if (vQueries.empty())
+        return false;
+
+    // answer in time order, whatever order they were asked in
+    vector<size_t> vOrder(vQueries.size());
+    for (size_t i = 0; i < vQueries.size(); i++)
+    {
+        vOrder[i] = i;
+        vQueries[i].aStartTime = STIM_TIME_NOTIME;
+        vQueries[i].aStopTime = STIM_TIME_NOTIME;
+        vQueries[i].sTaskPath.clear();
+    }
+    sort(vOrder.begin(), vOrder.end(), TTaskAtOrder(vQueries));
+
+    // seek to about a day before the first moment, then back to the last
+    // start or stop before that, which tells us what was going on there
+    m_pStats->Switch(STIM_PHASE_SEEK);
+    off_t iLow = BisectTime(vQueries[vOrder[0]].aWhen - SECONDS_IN_DAY);
+    StimReverseLineReader tReverse(m_tSnapshot);
+    tReverse.Seek(0, iLow);
+    TLogLine tLine;
+    TLogRecord tRecord;
+    off_t iScanStart = 0;
+    while (tReverse.NextLine(tLine))
+    {
+        if (DecodeRecord(tLine, tRecord, false)
+            && (tRecord.eEvent == STIM_EVENT_START 
+                || tRecord.eEvent == STIM_EVENT_STOP))
+        {
+            iScanStart = tRecord.iOffset;
+            break;
+        }
+    }
+    SeekScan(iScanStart);
+    ResetChunkScan(STIM_TIME_FOREVER, vector<string>());
+
+    // merge: each chunk settles the moments before its end, and whatever
+    // is running at the end of the log is running still
+    TTimeChunk tChunk;
+    size_t iNext = 0;
+    bool bFound = false;
+    while (iNext < vOrder.size())
+    {
+        bool bMore = ReadChunk(tChunk, false);
+        if (!bMore)
+        {
+            if (!RunningChunk(tChunk.aStartTime, tChunk.sTaskPath))
+                break;
+            tChunk.aStopTime = STIM_TIME_NOTIME;
+        }
+
+        while (iNext < vOrder.size() 
+            && (!bMore || vQueries[vOrder[iNext]].aWhen < tChunk.aStopTime))
+        {
+            TTaskAt& tQuery = vQueries[vOrder[iNext++]];
+            if (tQuery.aWhen >= tChunk.aStartTime)
+            {
+                tQuery.aStartTime = tChunk.aStartTime;
+                tQuery.aStopTime = tChunk.aStopTime;
+                tQuery.sTaskPath = tChunk.sTaskPath;
+                bFound = true;
+            }
+        }
+        if (!bMore)
+            break;
+    }
+
+    return bFound;
+}
+
+
+// -----------------------------------------------------------------------
+//                                                              SESSIONS
+// -----------------------------------------------------------------------
+
+/*
+ * A session is a stretch of work, typically a working day, but one that
+ * carries on past midnight is still the same session.  A start begins a new
+ * session when work had stopped and the day has changed since.
+ *
+ * The session index, <contract>.sessions, has a line per session giving
+ * the timestamp and byte offset of its first record.  StartTask() appends
+ * to it, so Status() can go straight to the current session; it is rebuilt
+ * from the log whenever it is missing or doesn't match the log.
+ */
+
+
+bool StartsNewSession(time_t aLastStop, time_t aStart)
+{
+    if (aLastStop == STIM_TIME_NOTIME)
+        return true;
+    return DetermineStartOfDay(aStart) != DetermineStartOfDay(aLastStop);
+}
+
+
+// last start or stop in the log, or in the part of it before iBefore
+bool FindLastTransition(
+    const StimSnapshot& tSnapshot, 
+    TLogRecord& tRecord, 
+    off_t iBefore)
+{
+    StimReverseLineReader tReader(tSnapshot);
+    if (iBefore >= 0)
+        tReader.Seek(0, iBefore);
+    TLogLine tLine;
+    while (tReader.NextLine(tLine))
+    {
+        if (DecodeRecord(tLine, tRecord, false)
+            && (tRecord.eEvent == STIM_EVENT_START 
+                || tRecord.eEvent == STIM_EVENT_STOP))
+            return true;
+    }
+
+    return false;
+}
+
+
+// read the last entry of a session index
+bool ReadLastSessionEntry(const string& sIndex, time_t& aTime, off_t& iOffset)
+{
+    int iFd = open(sIndex.c_str(), O_RDONLY);
+    if (iFd < 0)
+        return false;
+
+    // the last line is all we're after
+    char szTail[128];
+    struct stat tStat;
+    ssize_t iRead = -1;
+    if (fstat(iFd, &tStat) == 0 && tStat.st_size > 0)
+    {
+        off_t iFrom = tStat.st_size > (off_t) sizeof(szTail) - 1 
+            ? tStat.st_size - (sizeof(szTail) - 1) : 0;
+        iRead = pread(iFd, szTail, tStat.st_size - iFrom, iFrom);
+    }
+    close(iFd);
+    if (iRead <= 0 || szTail[iRead - 1] != '\n')
+        return false;
+    szTail[iRead - 1] = 0;
+
+    const char* szLine = strrchr(szTail, '\n');
+    szLine = szLine ? szLine + 1 : szTail;
+
+    char szTimestamp[18];
+    long long iValue;
+    if (sscanf(szLine, "%17c %lld", szTimestamp, &iValue) != 2)
+        return false;
+    szTimestamp[17] = 0;
+    GkGrokTimestamp(aTime, szTimestamp);
+    iOffset = (off_t) iValue;
+    return true;
+}
+
+
+off_t Stim::FindSessionStart(const StimSnapshot& tSnapshot)
+{
+    // trust the index only if it points at the start record it describes
+    time_t aTime;
+    off_t iOffset;
+    if (ReadLastSessionEntry(m_sSessionIndex, aTime, iOffset)
+        && iOffset < tSnapshot.Size()
+        && tSnapshot.LineStartFrom(iOffset) == iOffset)
+    {
+        TLogLine tLine;
+        TLogRecord tRecord;
+        StimMappedLineReader tReader(tSnapshot);
+        tReader.Seek(iOffset, tSnapshot.Size());
+        if (tReader.NextLine(tLine) 
+            && DecodeRecord(tLine, tRecord, false)
+            && tRecord.eEvent == STIM_EVENT_START
+            && tRecord.aTime == aTime)
+            return iOffset;
+    }
+
+    Trace("Rebuilding session index");
+    return RebuildSessionIndex(tSnapshot);
+}
+
+
+// Rebuild the session index from the log, returning the offset of the last
+// session's first record, or -1 if there is none.  Given an offset, only
+// the log from there on has changed, so entries before it are kept and the
+// rest of the log walked from the last start or stop before it.  Failing to
+// write the index isn't fatal: it is just rebuilt next time.
+off_t Stim::RebuildSessionIndex(const StimSnapshot& tSnapshot, off_t iFrom)
+{
+    string sTemp = m_sSessionIndex + ".tmp";
+    FILE* pIndex = fopen(sTemp.c_str(), "w");
+    time_t aLastStop = STIM_TIME_NOTIME;
+    bool bRunning = false;
+    off_t iSessionStart = -1;
+
+    // keep what still holds
+    FILE* pOld = (iFrom > 0 ? fopen(m_sSessionIndex.c_str(), "r") : NULL);
+    if (pOld == NULL)
+        iFrom = 0;
+    else
+    {
+        char szLine[64];
+        char szTimestamp[18];
+        long long iValue;
+        while (fgets(szLine, sizeof(szLine), pOld) != NULL
+            && sscanf(szLine, "%17c %lld", szTimestamp, &iValue) == 2
+            && iValue < iFrom)
+        {
+            iSessionStart = (off_t) iValue;
+            if (pIndex)
+                fputs(szLine, pIndex);
+        }
+        fclose(pOld);
+
+        TLogRecord tLast;
+        if (FindLastTransition(tSnapshot, tLast, iFrom))
+        {
+            bRunning = (tLast.eEvent == STIM_EVENT_START);
+            if (!bRunning)
+                aLastStop = tLast.aTime;
+        }
+    }
+
+    // walk through the log noting where sessions start
+    StimCursor tCursor(tSnapshot, &m_tStats);
+    tCursor.SetReadMode(m_eReadMode);
+    tCursor.SeekScan(iFrom);
+    TLogRecord tRecord;
+    while (tCursor.ReadRecord(tRecord, false))
+    {
+        if (tRecord.eEvent == STIM_EVENT_START)
+        {
+            if (!bRunning && StartsNewSession(aLastStop, tRecord.aTime))
+            {
+                iSessionStart = tRecord.iOffset;
+                if (pIndex)
+                {
+                    char szDate[18];
+                    GkMakeTimestamp(tRecord.aTime, szDate);
+                    fprintf(pIndex, "%s %lld\n", szDate, (long long) iSessionStart);
+                }
+            }
+            bRunning = true;
+        }
+        else if (tRecord.eEvent == STIM_EVENT_STOP)
+        {
+            if (bRunning)
+                aLastStop = tRecord.aTime;
+            bRunning = false;
+        }
+    }
+
+    // put the new index in place
+    if (pIndex)
+    {
+        if (fclose(pIndex) != 0 || rename(sTemp.c_str(), m_sSessionIndex.c_str()) != 0)
+            unlink(sTemp.c_str());
+    }
+
+    return iSessionStart;
+}
+
+
+// note a new session in the index if this start begins one
+void Stim::NoteSessionStart(time_t aStartTime)
+{
+    // nothing to maintain until there's an index; Status() builds it
+    if (access(m_sSessionIndex.c_str(), W_OK) != 0)
+        return;
+
+    this->EnsureInitialised();
+    StimSnapshot tSnapshot(m_sStimLog);
+
+    // still running, or stopped but on the same day?  Same session
+    TLogRecord tLast;
+    time_t aLastStop = STIM_TIME_NOTIME;
+    if (FindLastTransition(tSnapshot, tLast))
+    {
+        if (tLast.eEvent != STIM_EVENT_STOP)
+            return;
+        aLastStop = tLast.aTime;
+    }
+    if (!StartsNewSession(aLastStop, aStartTime))
+        return;
+
+    // the start record is about to be appended at the end of the log
+    FILE* pIndex = fopen(m_sSessionIndex.c_str(), "a");
+    if (pIndex == NULL)
+        return;
+    char szDate[18];
+    GkMakeTimestamp(aStartTime, szDate);
+    fprintf(pIndex, "%s %lld\n", szDate, (long long) tSnapshot.Size());
+    fclose(pIndex);
+}
+
+
+// Rebuild whatever sidecar files describe the log by offset.  The result
+// cache needs nothing doing, as a rewritten log is a new file to it, and
+// block sums are just dropped, as the next sync sums the log anyway; so is
+// the verified mark, until the log is next verified.
+void Stim::RebuildIndexes(void)
+{
+    StimSnapshot tSnapshot(m_sStimLog);
+    if (access(m_sSessionIndex.c_str(), F_OK) == 0)
+        RebuildSessionIndex(tSnapshot);
+    if (access(m_sTaskDictionary.c_str(), F_OK) == 0)
+    {
+        vector<TTaskUse> vTasks;
+        UpdateTaskDictionary(tSnapshot, vTasks, 0);
+    }
+    if (access(m_sDayIndex.c_str(), F_OK) == 0)
+    {
+        map<string, StimDaySet> vDays;
+        UpdateDayIndex(tSnapshot, vDays, 0);
+    }
+    unlink(m_sBlockSums.c_str());
+    unlink(m_sVerified.c_str());
+}
+
+
+// -----------------------------------------------------------------------
+//                                                       TASK DICTIONARY
+// -----------------------------------------------------------------------
+
+/*
+ * The task dictionary, <contract>.tasks, has a line per task path started
+ * in the log, in order, giving when it was last started and how many times,
+ * so that completing a task path doesn't mean reading the whole log.  Its
+ * first line gives the inode of the log and how much of it has been read.
+ * StartTask() keeps it up to date, and whatever else is added to the log is
+ * read the next time it is used.
+ */
+
+#define STIM_TASKS_MAGIC "stim-tasks 2"
+
+
+// Read a sidecar file describing the log up to some offset, as given in its
+// header with the inode of the log and a hash of its tail there.  It is only
+// any good if it was made from this file as it still stands, and, given
+// where the log changed, only from before that point; if so, the body after
+// the header is left in the text and how much of the log it describes
+// returned, else 0.
+off_t ReadSidecar(
+    const string& sFile, 
+    const char* szMagic, 
+    const StimSnapshot& tSnapshot, 
+    off_t iChanged,
+    string& sText,
+    const char*& pBody)
+{
+    // sidecars are small, so they're read in one go
+    sText.clear();
+    int iFd = open(sFile.c_str(), O_RDONLY);
+    if (iFd >= 0)
+    {
+        struct stat tStat;
+        if (fstat(iFd, &tStat) == 0 && tStat.st_size > 0)
+        {
+            sText.resize(tStat.st_size);
+            if (pread(iFd, &sText[0], tStat.st_size, 0) != tStat.st_size)
+                sText.clear();
+        }
+        close(iFd);
+    }
+
+    long long iInode, iOffset;
+    unsigned long long iTailHash;
+    int iUsed;
+    if (sscanf(sText.c_str(), "%*s %*d %lld %lld %llx\n%n", 
+            &iInode, &iOffset, &iTailHash, &iUsed) == 3
+        && sText.compare(0, strlen(szMagic), szMagic) == 0
+        && sText[iUsed - 1] == '\n'
+        && (ino_t) iInode == tSnapshot.FileStat().st_ino
+        && iOffset <= tSnapshot.Size()
+        && tSnapshot.LineStartFrom(iOffset) == iOffset
+        && (iChanged < 0 || iOffset <= iChanged)
+        && TailHash(tSnapshot, (off_t) iOffset) == iTailHash)
+    {
+        pBody = sText.c_str() + iUsed;
+        return (off_t) iOffset;
+    }
+
+    pBody = sText.c_str() + sText.size();
+    return 0;
+}
+
+
+// Start a new sidecar describing the whole of the log, written alongside
+// and put in place by CommitSidecar(); NULL if it can't be.
+FILE* CreateSidecar(const string& sFile, const char* szMagic, const StimSnapshot& tSnapshot)
+{
+    FILE* pSidecar = fopen((sFile + ".tmp").c_str(), "w");
+    if (pSidecar != NULL)
+        fprintf(pSidecar, "%s %lld %lld %016llx\n", szMagic,
+            (long long) tSnapshot.FileStat().st_ino, (long long) tSnapshot.Size(),
+            TailHash(tSnapshot, tSnapshot.Size()));
+    return pSidecar;
+}
+
+
+void CommitSidecar(FILE* pSidecar, const string& sFile)
+{
+    string sTemp = sFile + ".tmp";
+    if (fclose(pSidecar) != 0 || rename(sTemp.c_str(), sFile.c_str()) != 0)
+        unlink(sTemp.c_str());
+}
+
+
+bool TaskPathBefore(const TTaskUse& tTask, const string& sTaskPath)
+{
+    return tTask.sTaskPath < sTaskPath;
+}
+
+
+// Read the dictionary as far as it can be trusted and read the rest of the
+// log into it, writing it out again if that added anything.  Failing to
+// write it isn't fatal: the log is just read again next time.
+void Stim::UpdateTaskDictionary(
+    const StimSnapshot& tSnapshot, 
+    vector<TTaskUse>& vTasks,
+    off_t iChanged)
+{
+    vTasks.clear();
+    string sText;
+    const char* pLine;
+    off_t iRead = ReadSidecar(m_sTaskDictionary, STIM_TASKS_MAGIC, 
+        tSnapshot, iChanged, sText, pLine);
+    const char* pEnd = sText.c_str() + sText.size();
+    const char* pNewline;
+    for (; pLine < pEnd; pLine = pNewline + 1)
+    {
+        pNewline = (const char*) memchr(pLine, '\n', pEnd - pLine);
+        TTaskUse tTask;
+        char* pPath;
+        if (pNewline == NULL || pNewline - pLine < 20 || pLine[17] != ' '
+            || !DecodeTimestamp(pLine, tTask.aLastUsed))
+            break;
+        tTask.iUses = strtoul(pLine + 18, &pPath, 10);
+        if (*pPath != ' ' || pPath + 1 >= pNewline)
+            break;
+        tTask.sTaskPath.assign(pPath + 1, pNewline - pPath - 1);
+        vTasks.push_back(tTask);
+    }
+
+    // anything amiss and it's read again from scratch
+    if (pLine < pEnd)
+    {
+        vTasks.clear();
+        iRead = 0;
+    }
+
+    if (iRead == tSnapshot.Size())
+        return;
+    if (iRead == 0)
+        Trace("Rebuilding task dictionary");
+
+    // note the starts in the rest of the log
+    StimCursor tCursor(tSnapshot, &m_tStats);
+    tCursor.SetReadMode(m_eReadMode);
+    tCursor.SeekScan(iRead);
+    TLogRecord tRecord;
+    string sTaskPath;
+    while (tCursor.ReadRecord(tRecord, false))
+    {
+        if (tRecord.eEvent != STIM_EVENT_START || tRecord.iDetailLength == 0)
+            continue;
+
+        sTaskPath.assign(tRecord.pDetail, tRecord.iDetailLength);
+        vector<TTaskUse>::iterator i = 
+            lower_bound(vTasks.begin(), vTasks.end(), sTaskPath, TaskPathBefore);
+        if (i == vTasks.end() || i->sTaskPath != sTaskPath)
+        {
+            TTaskUse tTask;
+            tTask.sTaskPath = sTaskPath;
+            tTask.aLastUsed = tRecord.aTime;
+            tTask.iUses = 0;
+            i = vTasks.insert(i, tTask);
+        }
+        i->iUses++;
+        if (tRecord.aTime > i->aLastUsed)
+            i->aLastUsed = tRecord.aTime;
+    }
+
+    // put the new dictionary in place
+    FILE* pDictionary = CreateSidecar(m_sTaskDictionary, STIM_TASKS_MAGIC, tSnapshot);
+    if (pDictionary == NULL)
+        return;
+    char szDate[18];
+    for (size_t i = 0; i < vTasks.size(); i++)
+    {
+        GkMakeTimestamp(vTasks[i].aLastUsed, szDate);
+        fprintf(pDictionary, "%s %lu %s\n", 
+            szDate, vTasks[i].iUses, vTasks[i].sTaskPath.c_str());
+    }
+    CommitSidecar(pDictionary, m_sTaskDictionary);
+}
+
+
+// -----------------------------------------------------------------------
+//                                                             DAY INDEX
+// -----------------------------------------------------------------------
+
+/*
+ * The day index, <contract>.days, has a line per task path giving the days
+ * on which chunks of it started, as runs of consecutive days, so that which
+ * days a task was worked on comes without reading the log, and scans for
+ * certain tasks can skip the days they weren't.  It is kept up to date like
+ * the task dictionary, and its days are those of the timestamps in the log.
+ */
+
+#define STIM_DAYS_MAGIC "stim-days 2"
+
+
+size_t StimDaySet::Days(void) const
+{
+    size_t iDays = 0;
+    for (size_t i = 0; i < m_vRuns.size(); i++)
+        iDays += m_vRuns[i].iLast - m_vRuns[i].iFirst + 1;
+    return iDays;
+}
+
+
+void StimDaySet::Add(long iDay)
+{
+    // the usual case: the same day as last time, or a later one
+    if (!m_vRuns.empty() && iDay >= m_vRuns.back().iFirst)
+    {
+        if (iDay <= m_vRuns.back().iLast + 1)
+        {
+            if (iDay > m_vRuns.back().iLast)
+                m_vRuns.back().iLast = iDay;
+            return;
+        }
+    }
+    else if (!m_vRuns.empty())
+    {
+        // an earlier day, as from a backdated entry
+        StimDaySet tDay;
+        tDay.Add(iDay);
+        Union(tDay);
+        return;
+    }
+
+    TDayRun tRun;
+    tRun.iFirst = tRun.iLast = iDay;
+    m_vRuns.push_back(tRun);
+}
+
+
+void StimDaySet::Union(const StimDaySet& tOther)
+{
+    vector<TDayRun> vRuns;
+    vRuns.reserve(m_vRuns.size() + tOther.m_vRuns.size());
+    size_t i = 0, j = 0;
+    while (i < m_vRuns.size() || j < tOther.m_vRuns.size())
+    {
+        // take whichever run starts first, joining it to the last if they
+        // touch or overlap
+        const TDayRun& tRun = (j == tOther.m_vRuns.size() 
+            || (i < m_vRuns.size() && m_vRuns[i].iFirst <= tOther.m_vRuns[j].iFirst))
+            ? m_vRuns[i++] : tOther.m_vRuns[j++];
+        if (!vRuns.empty() && tRun.iFirst <= vRuns.back().iLast + 1)
+        {
+            if (tRun.iLast > vRuns.back().iLast)
+                vRuns.back().iLast = tRun.iLast;
+        }
+        else
+            vRuns.push_back(tRun);
+    }
+    m_vRuns.swap(vRuns);
+}
+
+
+void StimDaySet::Intersect(const StimDaySet& tOther)
+{
+    vector<TDayRun> vRuns;
+    size_t i = 0, j = 0;
+    while (i < m_vRuns.size() && j < tOther.m_vRuns.size())
+    {
+        TDayRun tRun;
+        tRun.iFirst = max(m_vRuns[i].iFirst, tOther.m_vRuns[j].iFirst);
+        tRun.iLast = min(m_vRuns[i].iLast, tOther.m_vRuns[j].iLast);
+        if (tRun.iFirst <= tRun.iLast)
+            vRuns.push_back(tRun);
+
+        // move on from whichever run ends first
+        if (m_vRuns[i].iLast < tOther.m_vRuns[j].iLast)
+            i++;
+        else
+            j++;
+    }
+    m_vRuns.swap(vRuns);
+}
+
+
+void StimDaySet::Clip(long iFirst, long iLast)
+{
+    vector<TDayRun> vRuns;
+    for (size_t i = 0; i < m_vRuns.size(); i++)
+    {
+        TDayRun tRun;
+        tRun.iFirst = max(m_vRuns[i].iFirst, iFirst);
+        tRun.iLast = min(m_vRuns[i].iLast, iLast);
+        if (tRun.iFirst <= tRun.iLast)
+            vRuns.push_back(tRun);
+    }
+    m_vRuns.swap(vRuns);
+}
+
+
+void StimDaySet::Write(FILE* pFile) const
+{
+    for (size_t i = 0; i < m_vRuns.size(); i++)
+        fprintf(pFile, i ? ",%ld+%ld" : "%ld+%ld", 
+            m_vRuns[i].iFirst, m_vRuns[i].iLast - m_vRuns[i].iFirst);
+}
+
+
+// read runs as written by Write(), which must be the whole of the text
+bool StimDaySet::Read(const char* pText, const char* pEnd)
+{
+    m_vRuns.clear();
+    while (pText < pEnd)
+    {
+        char* pNext;
+        TDayRun tRun;
+        tRun.iFirst = strtol(pText, &pNext, 10);
+        if (*pNext != '+')
+            return false;
+        tRun.iLast = tRun.iFirst + strtol(pNext + 1, &pNext, 10);
+        if (pNext > pEnd || (pNext < pEnd && *pNext != ',')
+            || tRun.iLast < tRun.iFirst
+            || (!m_vRuns.empty() && tRun.iFirst <= m_vRuns.back().iLast + 1))
+            return false;
+        m_vRuns.push_back(tRun);
+        pText = pNext + 1;
+    }
+    return !m_vRuns.empty();
+}
+
+
+// Read the index as far as it can be trusted and read the rest of the log
+// into it, writing it out again if that added anything.  Given task paths,
+// an index that's already up to date is only read for tasks matching them.
+void Stim::UpdateDayIndex(
+    const StimSnapshot& tSnapshot, 
+    map<string, StimDaySet>& vDays,
+    off_t iChanged,
+    const vector<string>* pTaskPaths)
+{
+    vDays.clear();
+    string sText;
+    const char* pLine;
+    off_t iRead = ReadSidecar(m_sDayIndex, STIM_DAYS_MAGIC, 
+        tSnapshot, iChanged, sText, pLine);
+    const char* pEnd = sText.c_str() + sText.size();
+    const char* pNewline;
+    bool bFilter = (pTaskPaths != NULL && iRead == tSnapshot.Size());
+    string sTaskPath;
+    for (; pLine < pEnd; pLine = pNewline + 1)
+    {
+        pNewline = (const char*) memchr(pLine, '\n', pEnd - pLine);
+        const char* pSpace = (pNewline 
+            ? (const char*) memchr(pLine, ' ', pNewline - pLine) : NULL);
+        if (pSpace == NULL || pSpace + 1 >= pNewline)
+            break;
+        sTaskPath.assign(pSpace + 1, pNewline);
+        if (bFilter && !TaskPathMatches(*pTaskPaths, sTaskPath))
+            continue;
+        if (!vDays[sTaskPath].Read(pLine, pSpace))
+            break;
+    }
+
+    // anything amiss and it's read again from scratch
+    if (pLine < pEnd)
+    {
+        vDays.clear();
+        iRead = 0;
+    }
+
+    if (iRead == tSnapshot.Size())
+        return;
+    if (iRead == 0)
+        Trace("Rebuilding day index");
+
+    // note the days of the starts in the rest of the log, straight from
+    // their timestamps
+    StimCursor tCursor(tSnapshot, &m_tStats);
+    tCursor.SetReadMode(m_eReadMode);
+    tCursor.SeekScan(iRead);
+    TLogRecord tRecord;
+    StimDaySet* pDays = NULL;
+    while (tCursor.ReadRecord(tRecord, false))
+    {
+        if (tRecord.eEvent != STIM_EVENT_START || tRecord.iDetailLength == 0)
+            continue;
+
+        if (pDays == NULL || sTaskPath.compare(0, string::npos, 
+                tRecord.pDetail, tRecord.iDetailLength) != 0)
+        {
+            sTaskPath.assign(tRecord.pDetail, tRecord.iDetailLength);
+            pDays = &vDays[sTaskPath];
+        }
+        const char* pStamp = tSnapshot.Data() + tRecord.iOffset;
+        pDays->Add(DayNumber(
+            (pStamp[0] - '0') * 1000 + (pStamp[1] - '0') * 100 
+                + (pStamp[2] - '0') * 10 + (pStamp[3] - '0'),
+            (pStamp[4] - '0') * 10 + (pStamp[5] - '0'),
+            (pStamp[6] - '0') * 10 + (pStamp[7] - '0')));
+    }
+
+    // put the new index in place
+    FILE* pIndex = CreateSidecar(m_sDayIndex, STIM_DAYS_MAGIC, tSnapshot);
+    if (pIndex == NULL)
+        return;
+    for (map<string, StimDaySet>::const_iterator it = vDays.begin(); 
+        it != vDays.end(); it++)
+    {
+        it->second.Write(pIndex);
+        fprintf(pIndex, " %s\n", it->first.c_str());
+    }
+    CommitSidecar(pIndex, m_sDayIndex);
+}
+
+
+// the days in the period on which any chunk of the given tasks started
+void ActiveDaysIn(
+    const map<string, StimDaySet>& vDays,
+    const vector<string>& vTaskPaths,
+    long iFirst,
+    long iLast,
+    StimDaySet& tDays)
+{
+    tDays.Clear();
+    for (map<string, StimDaySet>::const_iterator it = vDays.begin(); 
+        it != vDays.end(); it++)
+    {
+        if (TaskPathMatches(vTaskPaths, it->first))
+            tDays.Union(it->second);
+    }
+    tDays.Clip(iFirst, iLast);
+}
+
+
+// the first and last days of a period
+void PeriodDays(time_t aPeriodStart, time_t aPeriodEnd, long& iFirst, long& iLast)
+{
+    struct tm tTm;
+    localtime_r(&aPeriodStart, &tTm);
+    iFirst = DayNumber(tTm.tm_year + 1900, tTm.tm_mon + 1, tTm.tm_mday);
+    localtime_r(&aPeriodEnd, &tTm);
+    iLast = DayNumber(tTm.tm_year + 1900, tTm.tm_mon + 1, tTm.tm_mday);
+}
+
+
+bool Stim::ActiveDays(
+    time_t tNow,
+    const string& sDateRange, 
+    vector<string>& vTaskPaths,
+    bool bAll,
+    StimDaySet& tDays)
+{
+    this->EnsureInitialised();
+    StimSnapshot tSnapshot(m_sStimLog);
+    map<string, StimDaySet> vDays;
+    UpdateDayIndex(tSnapshot, vDays, -1, &vTaskPaths);
+
+    m_tStats.Switch(STIM_PHASE_AGGREGATE);
+    time_t aPeriodStart, aPeriodEnd;
+    DeterminePeriod(tNow, sDateRange, aPeriodStart, aPeriodEnd);
+    long iFirst, iLast;
+    PeriodDays(aPeriodStart, aPeriodEnd, iFirst, iLast);
+
+    // any of the tasks, or each of them
+    if (!bAll)
+        ActiveDaysIn(vDays, vTaskPaths, iFirst, iLast, tDays);
+    else
+    {
+        for (size_t i = 0; i < vTaskPaths.size(); i++)
+        {
+            StimDaySet tTaskDays;
+            ActiveDaysIn(vDays, vector<string>(1, vTaskPaths[i]), iFirst, iLast, tTaskDays);
+            if (i == 0)
+                tDays.Union(tTaskDays);
+            else
+                tDays.Intersect(tTaskDays);
+        }
+    }
+
+    return !tDays.Empty();
+}
+
+
+// Let a scan for certain tasks skip the days none of them were worked on,
+// if there is a day index to say which.
+void Stim::LimitToActiveDays(
+    const StimSnapshot& tSnapshot,
+    time_t tNow,
+    const string& sDateRange, 
+    const vector<string>& vTaskPaths,
+    StimCursor& tCursor)
+{
+    if (vTaskPaths.empty() || access(m_sDayIndex.c_str(), F_OK) != 0)
+        return;
+
+    map<string, StimDaySet> vDays;
+    UpdateDayIndex(tSnapshot, vDays, -1, &vTaskPaths);
+    time_t aPeriodStart, aPeriodEnd;
+    DeterminePeriod(tNow, sDateRange, aPeriodStart, aPeriodEnd);
+    long iFirst, iLast;
+    PeriodDays(aPeriodStart, aPeriodEnd, iFirst, iLast);
+    StimDaySet tDays;
+    ActiveDaysIn(vDays, vTaskPaths, iFirst, iLast, tDays);
+
+    vector<pair<time_t, time_t> > vPeriods;
+    for (size_t i = 0; i < tDays.Runs().size(); i++)
+    {
+        const TDayRun& tRun = tDays.Runs()[i];
+        vPeriods.push_back(make_pair(DayStart(tRun.iFirst), DayStart(tRun.iLast + 1)));
+    }
+    tCursor.SetScanPeriods(vPeriods);
+}
+
+
+// -----------------------------------------------------------------------
+//                                                                VACUUM
+// -----------------------------------------------------------------------
+
+/*
+ * Vacuuming drops records that make no difference to what is reported:
+ * starts of a task that is already running, as long as it was started the
+ * same day (so that daily reports come out the same), starts of chunks
+ * that end the moment they begin, and stops with nothing running.  Log
+ * messages and anything not understood are always kept.  A chunk taking no
+ * time but holding log messages is kept too, unless they're to be merged
+ * into the chunk that follows it.
+ */
+class LogVacuum
+{
+public:
+
+    LogVacuum(FILE* pOut, bool bMergeLogs, TVacuumStats& tStats)
+      : m_pOut(pOut), m_bMergeLogs(bMergeLogs), m_tStats(tStats)
+    {
+        m_bRunning = false;
+        m_aStartDay = STIM_TIME_NOTIME;
+        m_bHolding = false;
+        m_iWritten = 0;
+    }
+
+    void Line(const TLogLine& tLine);
+    off_t Finish(void) { Release(); return m_iWritten; }
+
+private:
+
+    void Write(const TLogLine& tLine)
+    {
+        if (m_pOut)
+        {
+            fwrite(tLine.pText, 1, tLine.iLength, m_pOut);
+            fputc('\n', m_pOut);
+        }
+        m_iWritten += tLine.iLength + 1;
+    }
+
+    // write out a held start and what followed it; it stands
+    void Release(void)
+    {
+        if (!m_bHolding)
+            return;
+        for (size_t i = 0; i < m_vHeld.size(); i++)
+            Write(m_vHeld[i]);
+        m_bRunning = true;
+        m_sTask = m_sHeldTask;
+        m_aStartDay = DetermineStartOfDay(m_tHeld.aTime);
+        m_bHolding = false;
+        m_vHeld.clear();
+    }
+
+    FILE* m_pOut;
+    bool m_bMergeLogs;
+    TVacuumStats& m_tStats;
+    off_t m_iWritten;
+
+    // what the log written so far has running
+    bool m_bRunning;
+    string m_sTask;
+    time_t m_aStartDay;
+
+    // a start is held back, along with the lines after it, until the next
+    // start or stop shows whether its chunk took any time
+    bool m_bHolding;
+    TLogRecord m_tHeld;
+    string m_sHeldTask;
+    vector<TLogLine> m_vHeld;
+};
+
+
+void LogVacuum::Line(const TLogLine& tLine)
+{
+    m_tStats.iRecords++;
+
+    // log messages and the like stay where they are
+    TLogRecord tRecord;
+    if (!DecodeRecord(tLine, tRecord, false)
+        || (tRecord.eEvent != STIM_EVENT_START 
+            && tRecord.eEvent != STIM_EVENT_STOP))
+    {
+        if (m_bHolding)
+            m_vHeld.push_back(tLine);
+        else
+            Write(tLine);
+        return;
+    }
+
+    // did the held start's chunk take any time?
+    vector<TLogLine> vMessages;
+    if (m_bHolding)
+    {
+        if (tRecord.aTime != m_tHeld.aTime)
+            Release();
+        else if (m_vHeld.size() == 1 
+            || (m_bMergeLogs && tRecord.eEvent == STIM_EVENT_START))
+        {
+            // no, so it goes, but its messages go to the next chunk
+            m_tStats.iEmptyChunks++;
+            vMessages.assign(m_vHeld.begin() + 1, m_vHeld.end());
+            m_bHolding = false;
+            m_vHeld.clear();
+        }
+        else
+            Release();
+    }
+
+    if (tRecord.eEvent == STIM_EVENT_STOP)
+    {
+        if (m_bRunning)
+        {
+            Write(tLine);
+            m_bRunning = false;
+        }
+        else
+            m_tStats.iStrayStops++;
+        return;
+    }
+
+    string sTask(tRecord.pDetail, tRecord.iDetailLength);
+    if (m_bRunning && sTask == m_sTask 
+        && DetermineStartOfDay(tRecord.aTime) == m_aStartDay)
+    {
+        // carrying on with what was running
+        m_tStats.iMergedStarts++;
+        for (size_t i = 0; i < vMessages.size(); i++)
+            Write(vMessages[i]);
+        return;
+    }
+
+    m_bHolding = true;
+    m_tHeld = tRecord;
+    m_sHeldTask = sTask;
+    m_vHeld.assign(1, tLine);
+    m_vHeld.insert(m_vHeld.end(), vMessages.begin(), vMessages.end());
+}
+
+
+// Stream the log once, dropping redundant records, and unless this is a dry
+// run put the result in its place.  The new log is written to a temporary
+// file and synced before being renamed over the old one, so a crash leaves
+// one or the other intact.
+void Stim::Vacuum(bool bDryRun, bool bMergeLogs, TVacuumStats& tStats)
+{
+    this->EnsureInitialised();
+    memset(&tStats, 0, sizeof(tStats));
+
+    // nothing torn to trip over
+    if (!bDryRun)
+        RecoverTail();
+    StimSnapshot tSnapshot(m_sStimLog);
+    tStats.iBytes = tSnapshot.Size();
+
+    string sTemp = m_sStimLog + ".tmp";
+    FILE* pOut = NULL;
+    if (!bDryRun)
+    {
+        pOut = fopen(sTemp.c_str(), "w");
+        if (pOut == NULL)
+            throw "Failed to create " + sTemp;
+    }
+
+    m_tStats.Switch(STIM_PHASE_PARSE);
+    LogVacuum tVacuum(pOut, bMergeLogs, tStats);
+    StimMappedLineReader tReader(tSnapshot);
+    tReader.Seek(0, tSnapshot.Size());
+    TLogLine tLine;
+    while (tReader.NextLine(tLine))
+    {
+        m_tStats.iLines++;
+        m_tStats.iBytes += tLine.iLength + 1;
+        tVacuum.Line(tLine);
+    }
+    tStats.iBytesSaved = tStats.iBytes - tVacuum.Finish();
+
+    if (bDryRun)
+        return;
+
+    // nothing saved, nothing to do
+    m_tStats.Switch(STIM_PHASE_OUTPUT);
+    if (tStats.iBytesSaved <= 0)
+    {
+        fclose(pOut);
+        unlink(sTemp.c_str());
+        return;
+    }
+
+    if (fflush(pOut) != 0 || fsync(fileno(pOut)) != 0)
+    {
+        fclose(pOut);
+        unlink(sTemp.c_str());
+        throw "Failed to write " + sTemp;
+    }
+    fclose(pOut);
+
+    // records added meanwhile would be lost
+    struct stat tStat;
+    if (stat(m_sStimLog.c_str(), &tStat) != 0 
+        || tStat.st_ino != tSnapshot.FileStat().st_ino
+        || tStat.st_size != tSnapshot.Size())
+    {
+        unlink(sTemp.c_str());
+        throw "Log changed while vacuuming; try again";
+    }
+
+    chmod(sTemp.c_str(), tStat.st_mode & 07777);
+    if (rename(sTemp.c_str(), m_sStimLog.c_str()) != 0)
+    {
+        unlink(sTemp.c_str());
+        throw "Failed to replace " + m_sStimLog;
+    }
+    int iDir = open(m_sStimDir.c_str(), O_RDONLY);
+    if (iDir >= 0)
+    {
+        fsync(iDir);
+        close(iDir);
+    }
+
+    // any open handle is on the old log
+    m_fLog.close();
+    RebuildIndexes();
+}
+
+
+// -----------------------------------------------------------------------
+//                                                                  SYNC
+// -----------------------------------------------------------------------
+
+/*
+ * Two copies of a log, say on a laptop and a desktop, start out the same
+ * and then each has records appended.  Syncing finds how much of the start
+ * they still agree on, merges what follows from both by time, dropping
+ * records both have, and puts the result in place of what follows in each.
+ *
+ * Finding where they part is cheap: each keeps <contract>.blocks, the sums
+ * of its log's whole blocks, brought up to date by summing blocks added
+ * since.  The copies agree up to the first block whose sums differ, and
+ * within that block are compared byte by byte.  Replacing what follows is
+ * done by way of <contract>.sync, a journal holding the offset and the new
+ * records, so that a crash part way through is made good the next time the
+ * log is written.  So a sync reads and writes about as much as has changed
+ * since the last, whatever the size of the logs.
+ */
+
+#define STIM_BLOCKS_MAGIC "stim-blocks 1"
+#define STIM_SYNC_MAGIC "stim-sync 1"
+#define STIM_SYNC_BLOCK (64 * 1024)
+
+// each sum is eight hex digits and a newline
+#define STIM_BLOCK_SUM_LENGTH 9
+
+
+static unsigned long BlockSum(const StimSnapshot& tSnapshot, size_t iBlock)
+{
+    return StimChecksum(tSnapshot.Data() + (off_t) iBlock * STIM_SYNC_BLOCK, 
+        STIM_SYNC_BLOCK);
+}
+
+
+// Sums of every whole block of the log.  Those in the sidecar are taken as
+// they are if it was made for this file, isn't longer than it and its last
+// sum still holds, which is as much as the result cache trusts of a log
+// that has grown.  Failing to write the sidecar isn't fatal.
+void Stim::ReadBlockSums(const StimSnapshot& tSnapshot, vector<unsigned long>& vSums)
+{
+    vSums.clear();
+    size_t iBlocks = tSnapshot.Size() / STIM_SYNC_BLOCK;
+
+    FILE* pSums = fopen(m_sBlockSums.c_str(), "r");
+    bool bSidecar = (pSums != NULL);
+    if (bSidecar)
+    {
+        char szLine[64];
+        long long iInode;
+        if (fgets(szLine, sizeof(szLine), pSums) != NULL
+            && sscanf(szLine, STIM_BLOCKS_MAGIC " %lld", &iInode) == 1
+            && (ino_t) iInode == tSnapshot.FileStat().st_ino)
+        {
+            unsigned long iSum;
+            while (vSums.size() < iBlocks
+                && fgets(szLine, sizeof(szLine), pSums) != NULL
+                && strlen(szLine) == STIM_BLOCK_SUM_LENGTH
+                && sscanf(szLine, "%lx", &iSum) == 1)
+                vSums.push_back(iSum);
+        }
+        fclose(pSums);
+
+        if (!vSums.empty() && BlockSum(tSnapshot, vSums.size() - 1) != vSums.back())
+            vSums.clear();
+    }
+
+    // sum what's new, starting over if nothing could be kept
+    size_t iKept = vSums.size();
+    if (iKept == iBlocks && bSidecar)
+        return;
+    Trace("Summing log blocks");
+    for (size_t i = iKept; i < iBlocks; i++)
+        vSums.push_back(BlockSum(tSnapshot, i));
+
+    // sums are fixed length, so what's kept is left alone
+    pSums = fopen(m_sBlockSums.c_str(), iKept > 0 ? "r+" : "w");
+    if (pSums == NULL)
+        return;
+    if (iKept == 0)
+        fprintf(pSums, STIM_BLOCKS_MAGIC " %lld\n", 
+            (long long) tSnapshot.FileStat().st_ino);
+    else
+    {
+        char szHeader[64];
+        if (fgets(szHeader, sizeof(szHeader), pSums) == NULL)
+        {
+            fclose(pSums);
+            return;
+        }
+        fseeko(pSums, strlen(szHeader) + (off_t) iKept * STIM_BLOCK_SUM_LENGTH, SEEK_SET);
+    }
+    for (size_t i = iKept; i < iBlocks; i++)
+        fprintf(pSums, "%08lx\n", vSums[i]);
+    fflush(pSums);
+    if (ftruncate(fileno(pSums), ftello(pSums)) != 0)
+        Trace("Failed to trim block sums");
+    fclose(pSums);
+}
+
+
+// Forget the sums of blocks no longer all there.  Those left are made over
+// to the log as it now is, as replacing its tail makes it a new file.
+void Stim::TruncateBlockSums(ino_t iWasInode, off_t iSize)
+{
+    FILE* pSums = fopen(m_sBlockSums.c_str(), "r");
+    if (pSums == NULL)
+        return;
+
+    char szLine[64];
+    long long iInode;
+    bool bKeep = (fgets(szLine, sizeof(szLine), pSums) != NULL
+        && sscanf(szLine, STIM_BLOCKS_MAGIC " %lld", &iInode) == 1
+        && (ino_t) iInode == iWasInode);
+    string sSums;
+    size_t iBlocks = iSize / STIM_SYNC_BLOCK;
+    for (size_t i = 0; bKeep && i < iBlocks
+        && fgets(szLine, sizeof(szLine), pSums) != NULL
+        && strlen(szLine) == STIM_BLOCK_SUM_LENGTH; i++)
+        sSums += szLine;
+    fclose(pSums);
+
+    struct stat tStat;
+    string sTemp = m_sBlockSums + ".tmp";
+    FILE* pNew = NULL;
+    if (bKeep && stat(m_sStimLog.c_str(), &tStat) == 0)
+        pNew = fopen(sTemp.c_str(), "w");
+    if (pNew == NULL)
+    {
+        unlink(m_sBlockSums.c_str());
+        return;
+    }
+    fprintf(pNew, STIM_BLOCKS_MAGIC " %lld\n%s", 
+        (long long) tStat.st_ino, sSums.c_str());
+    if (fclose(pNew) != 0 || rename(sTemp.c_str(), m_sBlockSums.c_str()) != 0)
+    {
+        unlink(sTemp.c_str());
+        unlink(m_sBlockSums.c_str());
+    }
+}
+
+
+// Put the given records in place of the log from iFrom on, which must still
+// be as it was in the snapshot.  Plain appends are just written; anything
+// else goes through the journal.
+void Stim::ReplaceTail(const StimSnapshot& tSnapshot, off_t iFrom, const string& sTail)
+{
+    // records added meanwhile would be lost
+    struct stat tStat;
+    if (stat(m_sStimLog.c_str(), &tStat) != 0 
+        || tStat.st_ino != tSnapshot.FileStat().st_ino
+        || tStat.st_size != tSnapshot.Size())
+        throw "Log changed while syncing; try again: " + m_sStimLog;
+
+    if (iFrom == tSnapshot.Size())
+    {
+        int iFd = open(m_sStimLog.c_str(), O_WRONLY | O_APPEND);
+        if (iFd < 0)
+            throw "Failed to open log file: " + m_sStimLog;
+        bool bWritten = (write(iFd, sTail.data(), sTail.size()) == (ssize_t) sTail.size()
+            && fsync(iFd) == 0);
+        close(iFd);
+        if (!bWritten)
+            throw "Failed to write " + m_sStimLog;
+    }
+    else
+    {
+        string sTemp = m_sSyncJournal + ".tmp";
+        FILE* pJournal = fopen(sTemp.c_str(), "w");
+        if (pJournal == NULL)
+            throw "Failed to create " + sTemp;
+        fprintf(pJournal, STIM_SYNC_MAGIC " %lld\n", (long long) iFrom);
+        fwrite(sTail.data(), 1, sTail.size(), pJournal);
+        if (fflush(pJournal) != 0 || fsync(fileno(pJournal)) != 0
+            || fclose(pJournal) != 0
+            || rename(sTemp.c_str(), m_sSyncJournal.c_str()) != 0)
+        {
+            unlink(sTemp.c_str());
+            throw "Failed to write " + sTemp;
+        }
+        FinishSync();
+    }
+
+    // any open handle may be past the end
+    m_fLog.close();
+
+    StimSnapshot tNew(m_sStimLog);
+    if (access(m_sSessionIndex.c_str(), F_OK) == 0)
+        RebuildSessionIndex(tNew, iFrom);
+    if (access(m_sTaskDictionary.c_str(), F_OK) == 0)
+    {
+        vector<TTaskUse> vTasks;
+        UpdateTaskDictionary(tNew, vTasks, iFrom);
+    }
+    if (access(m_sDayIndex.c_str(), F_OK) == 0)
+    {
+        map<string, StimDaySet> vDays;
+        UpdateDayIndex(tNew, vDays, iFrom);
+    }
+    TruncateBlockSums(tSnapshot.FileStat().st_ino, iFrom);
+    TruncateVerified(tSnapshot.FileStat().st_ino, iFrom);
+}
+
+
+// Carry out the journal, if there is one: replace the log with what it
+// holds up to the offset the journal gives followed by the records after
+// it.  Doing so again is harmless, so a journal is only removed once the
+// new log is safely in place.
+void Stim::FinishSync(void)
+{
+    FILE* pJournal = fopen(m_sSyncJournal.c_str(), "r");
+    if (pJournal == NULL)
+        return;
+
+    Trace("Finishing sync");
+    char szHeader[64];
+    long long iFrom;
+    if (fgets(szHeader, sizeof(szHeader), pJournal) == NULL
+        || sscanf(szHeader, STIM_SYNC_MAGIC " %lld", &iFrom) != 1)
+    {
+        fclose(pJournal);
+        throw "Unreadable sync journal " + m_sSyncJournal;
+    }
+    string sTail;
+    char acBuffer[65536];
+    size_t iRead;
+    while ((iRead = fread(acBuffer, 1, sizeof(acBuffer), pJournal)) > 0)
+        sTail.append(acBuffer, iRead);
+    fclose(pJournal);
+
+    if (!ReplaceLog((off_t) iFrom, sTail))
+        throw "Failed to replace " + m_sStimLog;
+    unlink(m_sSyncJournal.c_str());
+}
+
+
+/*
+ * A record of one copy's tail, with the time it is merged by.  Lines that
+ * can't be decoded keep their place after the record before them.
+ */
+struct TSyncRecord
+{
+  time_t aTime;
+  const char* pText;
+  size_t iLength;             // including the newline
+  size_t iRecordLength;       // leaving out any checksum
+};
+
+
+static void ReadSyncRecords(
+    const StimSnapshot& tSnapshot, 
+    off_t iFrom, 
+    vector<TSyncRecord>& vRecords,
+    TStimStats& tStats)
+{
+    StimMappedLineReader tReader(tSnapshot);
+    tReader.Seek(iFrom, tSnapshot.Size());
+    TLogLine tLine;
+    TLogRecord tRecord;
+    time_t aTime = 0;
+    while (tReader.NextLine(tLine))
+    {
+        tStats.iLines++;
+        tStats.iBytes += tLine.iLength + 1;
+        if (DecodeRecord(tLine, tRecord, false))
+            aTime = tRecord.aTime;
+
+        TSyncRecord tSync;
+        tSync.aTime = aTime;
+        tSync.pText = tLine.pText;
+        tSync.iLength = tLine.iLength + 1;
+        tSync.iRecordLength = tLine.iLength;
+        CheckChecksum(tLine.pText, tSync.iRecordLength);
+        vRecords.push_back(tSync);
+    }
+}
+
+
+void Stim::Sync(Stim& tOther, TSyncStats& tStats)
+{
+    this->EnsureInitialised();
+    tOther.EnsureInitialised();
+    memset(&tStats, 0, sizeof(tStats));
+
+    // nothing torn, or left half synced, on either side
+    RecoverTail();
+    tOther.RecoverTail();
+    StimSnapshot tOurs(m_sStimLog);
+    StimSnapshot tTheirs(tOther.m_sStimLog);
+
+    // how far the copies agree, by the block, then the byte, then back to
+    // the start of a record
+    m_tStats.Switch(STIM_PHASE_SEEK);
+    vector<unsigned long> vOurSums, vTheirSums;
+    ReadBlockSums(tOurs, vOurSums);
+    tOther.ReadBlockSums(tTheirs, vTheirSums);
+    size_t iBlock = 0;
+    while (iBlock < vOurSums.size() && iBlock < vTheirSums.size()
+        && vOurSums[iBlock] == vTheirSums[iBlock])
+        iBlock++;
+
+    off_t iCommon = (off_t) iBlock * STIM_SYNC_BLOCK;
+    off_t iLimit = min(tOurs.Size(), tTheirs.Size());
+    while (iCommon < iLimit && tOurs.Data()[iCommon] == tTheirs.Data()[iCommon])
+        iCommon++;
+    while (iCommon > 0 && tOurs.Data()[iCommon - 1] != '\n')
+        iCommon--;
+    tStats.iCommon = iCommon;
+
+    // merge the rest by time, ours first where they're the same
+    m_tStats.Switch(STIM_PHASE_PARSE);
+    vector<TSyncRecord> vOurs, vTheirs;
+    ReadSyncRecords(tOurs, iCommon, vOurs, m_tStats);
+    ReadSyncRecords(tTheirs, iCommon, vTheirs, m_tStats);
+
+    m_tStats.Switch(STIM_PHASE_AGGREGATE);
+    map<string, unsigned long> vOurRecords;
+    for (size_t i = 0; i < vOurs.size(); i++)
+        vOurRecords[string(vOurs[i].pText, vOurs[i].iRecordLength)]++;
+
+    string sMerged;
+    size_t iOurs = 0, iTheirs = 0;
+    while (iOurs < vOurs.size() || iTheirs < vTheirs.size())
+    {
+        if (iTheirs == vTheirs.size() 
+            || (iOurs < vOurs.size() && vOurs[iOurs].aTime <= vTheirs[iTheirs].aTime))
+        {
+            sMerged.append(vOurs[iOurs].pText, vOurs[iOurs].iLength);
+            iOurs++;
+            continue;
+        }
+
+        const TSyncRecord& tTheirs = vTheirs[iTheirs++];
+        map<string, unsigned long>::iterator it = 
+            vOurRecords.find(string(tTheirs.pText, tTheirs.iRecordLength));
+        if (it != vOurRecords.end() && it->second > 0)
+        {
+            it->second--;
+            tStats.iDuplicates++;
+            continue;
+        }
+        sMerged.append(tTheirs.pText, tTheirs.iLength);
+        tStats.iPulled++;
+    }
+    tStats.iPushed = vOurs.size() - tStats.iDuplicates;
+
+    // and put it in place wherever it differs
+    m_tStats.Switch(STIM_PHASE_OUTPUT);
+    if (sMerged.compare(0, string::npos, tOurs.Data() + iCommon, tOurs.Size() - iCommon) != 0)
+        ReplaceTail(tOurs, iCommon, sMerged);
+    if (sMerged.compare(0, string::npos, tTheirs.Data() + iCommon, tTheirs.Size() - iCommon) != 0)
+        tOther.ReplaceTail(tTheirs, iCommon, sMerged);
+}
+
+
+// -----------------------------------------------------------------------
+//                                                          RESULT CACHE
+// -----------------------------------------------------------------------
+
+/*
+ * Reports over periods that are over and done with don't change, so their
+ * results may be kept in STIM_HOME/cache, a file per report.  A result is
+ * keyed on the contract, the period as worked out by DeterminePeriod() and
+ * the task paths, and notes the generation of the log it was made from: its
+ * inode, size, modification time and a hash of its last few kilobytes.
+ *
+ * A result holds while the log is unchanged.  It still holds once records
+ * have been appended, as long as the log had already carried on past the
+ * end of the period, the tail hash shows the old log is all still there,
+ * and none of the new records are backdated into the period.  Anything
+ * else, such as a hand edit, is a miss.  The least recently used results
+ * are dropped to keep the cache within its size limit.
+ */
+
+#define STIM_CACHE_MAGIC "stim-cache 1"
+#define STIM_CACHE_TAIL 4096
+
+
+// FNV-1a, which is plenty for telling files apart
+unsigned long long HashBytes(const char* pData, size_t iLength)
+{
+    unsigned long long iHash = 14695981039346656037ULL;
+    for (size_t i = 0; i < iLength; i++)
+    {
+        iHash ^= (unsigned char) pData[i];
+        iHash *= 1099511628211ULL;
+    }
+    return iHash;
+}
+
+
+// hash of the last few kilobytes of the log as it was at the given size
+unsigned long long TailHash(const StimSnapshot& tSnapshot, off_t iSize)
+{
+    off_t iFrom = iSize > STIM_CACHE_TAIL ? iSize - STIM_CACHE_TAIL : 0;
+    return HashBytes(tSnapshot.Data() + iFrom, iSize - iFrom);
+}
+
+
+// whether every record from the given offset on is later than aTime
+bool AllRecordsAfter(const StimSnapshot& tSnapshot, off_t iOffset, time_t aTime)
+{
+    StimMappedLineReader tReader(tSnapshot);
+    tReader.Seek(iOffset, tSnapshot.Size());
+    TLogLine tLine;
+    TLogRecord tRecord;
+    while (tReader.NextLine(tLine))
+    {
+        if (DecodeRecord(tLine, tRecord, false) && tRecord.aTime <= aTime)
+            return false;
+    }
+    return true;
+}
+
+
+string CacheFile(const string& sCacheDir, const string& sKey)
+{
+    char szName[17];
+    snprintf(szName, sizeof(szName), "%016llx", HashBytes(sKey.data(), sKey.length()));
+    return sCacheDir + "/" + szName;
+}
+
+
+string Stim::CacheKey(
+    const char* szKind,
+    time_t aPeriodStart,
+    time_t aPeriodEnd,
+    const vector<string>& vTaskPaths)
+{
+    // the same task paths in any order make the same report
+    vector<string> vSorted(vTaskPaths);
+    sort(vSorted.begin(), vSorted.end());
+
+    ostringstream sKey;
+    sKey << szKind << ' ' << m_sContract << ' ' 
+        << (long long) aPeriodStart << ' ' << (long long) aPeriodEnd;
+    for (vector<string>::iterator it = vSorted.begin(); it != vSorted.end(); it++)
+        sKey << '\t' << *it;
+    return sKey.str();
+}
+
+
+// Look up the result for tResult.sKey, filling in tResult if there is one
+// that still holds for the log in the given snapshot
+bool Stim::ReadCache(const StimSnapshot& tSnapshot, TCachedResult& tResult)
+{
+    // one read for the lot
+    string sFile = CacheFile(m_sCacheDir, tResult.sKey);
+    int iFd = open(sFile.c_str(), O_RDONLY);
+    if (iFd < 0)
+    {
+        Trace("Cache miss");
+        return false;
+    }
+    struct stat tCacheStat;
+    string sCache;
+    if (fstat(iFd, &tCacheStat) == 0)
+    {
+        sCache.resize(tCacheStat.st_size);
+        if (tCacheStat.st_size == 0
+            || read(iFd, &sCache[0], tCacheStat.st_size) != tCacheStat.st_size)
+            sCache.clear();
+    }
+    close(iFd);
+
+    // is it the result we're after?
+    string sHeader = string(STIM_CACHE_MAGIC "\n") + tResult.sKey + "\n";
+    if (sCache.compare(0, sHeader.length(), sHeader) != 0)
+    {
+        Trace("Cache miss");
+        return false;
+    }
+
+    // which log was it made from?
+    const char* pPos = sCache.c_str() + sHeader.length();
+    const char* pEnd = sCache.c_str() + sCache.length();
+    unsigned long long iInode, iTailHash;
+    long long iSize, iModified;
+    int iClosed, iUsed;
+    if (sscanf(pPos, "%llu %lld %lld %llx %d\n%n", 
+             &iInode, &iSize, &iModified, &iTailHash, &iClosed, &iUsed) != 5)
+        return false;
+    pPos += iUsed;
+
+    // and is that still the log we have, give or take some appends?
+    const struct stat& tStat = tSnapshot.FileStat();
+    bool bValid = false;
+    if ((unsigned long long) tStat.st_ino == iInode 
+        && tSnapshot.Size() >= (off_t) iSize
+        && TailHash(tSnapshot, (off_t) iSize) == iTailHash)
+    {
+        if (tSnapshot.Size() == (off_t) iSize)
+            bValid = ((long long) tStat.st_mtime == iModified);
+        else
+            bValid = iClosed 
+                && AllRecordsAfter(tSnapshot, (off_t) iSize, tResult.aPeriodEnd);
+    }
+    if (!bValid)
+    {
+        Trace("Cache entry is stale");
+        return false;
+    }
+
+    // read back the results, a line each: "C <start> <stop> <task>",
+    // "L <time> <message>" or "T <seconds> <task>"
+    tResult.tReport.Clear();
+    tResult.vTaskTime.clear();
+    while (pPos < pEnd)
+    {
+        const char* pEol = (const char*) memchr(pPos, '\n', pEnd - pPos);
+        if (pEol == NULL || pEol - pPos < 2)
+            return false;
+        char cType = *pPos;
+        char* pText;
+        long long iFirst = strtoll(pPos + 2, &pText, 10);
+        if (cType == 'C')
+        {
+            time_t aStopTime = (time_t) strtoll(pText, &pText, 10);
+            tResult.tReport.BeginChunk((time_t) iFirst, pText + 1, pEol - pText - 1);
+            tResult.tReport.EndChunk(aStopTime);
+        }
+        else if (cType == 'L' && !tResult.tReport.Empty())
+            tResult.tReport.AddLog((time_t) iFirst, pText + 1, pEol - pText - 1);
+        else if (cType == 'T')
+            tResult.vTaskTime[string(pText + 1, pEol - pText - 1)] = (time_t) iFirst;
+        else
+            return false;
+        pPos = pEol + 1;
+    }
+
+    // freshen it up, as far as eviction is concerned
+    utime(sFile.c_str(), NULL);
+    Trace("Cache hit");
+    return true;
+}
+
+
+// Store a result in the cache.  The cache is only an optimisation, so
+// failing to write it isn't an error.
+void Stim::WriteCache(const StimSnapshot& tSnapshot, TCachedResult& tResult)
+{
+    const struct stat& tStat = tSnapshot.FileStat();
+    tResult.iInode = tStat.st_ino;
+    tResult.iSize = tSnapshot.Size();
+    tResult.aModified = tStat.st_mtime;
+    tResult.iTailHash = TailHash(tSnapshot, tResult.iSize);
+
+    if (mkdir(m_sCacheDir.c_str(), 0700) != 0 && errno != EEXIST)
+        return;
+
+    string sFile = CacheFile(m_sCacheDir, tResult.sKey);
+    ostringstream sTemp;
+    sTemp << sFile << ".tmp" << getpid();
+    FILE* pCache = fopen(sTemp.str().c_str(), "w");
+    if (pCache == NULL)
+        return;
+
+    fprintf(pCache, "%s\n%s\n%llu %lld %lld %llx %d\n", 
+        STIM_CACHE_MAGIC, tResult.sKey.c_str(),
+        (unsigned long long) tResult.iInode, (long long) tResult.iSize,
+        (long long) tResult.aModified, tResult.iTailHash, 
+        tResult.bClosed ? 1 : 0);
+    const StimReport& tReport = tResult.tReport;
+    for (size_t i = 0; i < tReport.Size(); i++)
+    {
+        const TReportChunk& tChunk = tReport[i];
+        fprintf(pCache, "C %lld %lld %s\n", (long long) tChunk.aStartTime,
+            (long long) tChunk.aStopTime, tChunk.szTaskPath);
+        for (size_t j = 0; j < tChunk.iLogCount; j++)
+            fprintf(pCache, "L %lld %s\n", 
+                (long long) tReport.Log(tChunk, j).aLogTime, 
+                tReport.Log(tChunk, j).szMessage);
+    }
+    for (map<string, time_t>::iterator it = tResult.vTaskTime.begin();
+        it != tResult.vTaskTime.end(); it++)
+        fprintf(pCache, "T %lld %s\n", (long long) it->second, it->first.c_str());
+
+    if (fclose(pCache) != 0 || rename(sTemp.str().c_str(), sFile.c_str()) != 0)
+    {
+        unlink(sTemp.str().c_str());
+        return;
+    }
+
+    TrimCache();
+}
+
+
+// drop least recently used results until the cache is within its limit
+void Stim::TrimCache(void)
+{
+    DIR* pDir = opendir(m_sCacheDir.c_str());
+    if (pDir == NULL)
+        return;
+
+    vector<pair<double, string> > vFiles;
+    map<string, off_t> vSizes;
+    off_t iTotal = 0;
+    struct dirent* pEntry;
+    while ((pEntry = readdir(pDir)) != NULL)
+    {
+        // results only, not temporary files or anything else
+        if (strlen(pEntry->d_name) != 16 
+            || strspn(pEntry->d_name, "0123456789abcdef") != 16)
+            continue;
+
+        string sFile = m_sCacheDir + "/" + pEntry->d_name;
+        struct stat tStat;
+        if (stat(sFile.c_str(), &tStat) != 0)
+            continue;
+        vFiles.push_back(make_pair(
+            tStat.st_mtim.tv_sec + tStat.st_mtim.tv_nsec / 1e9, sFile));
+        vSizes[sFile] = tStat.st_size;
+        iTotal += tStat.st_size;
+    }
+    closedir(pDir);
+
+    sort(vFiles.begin(), vFiles.end());
+    for (size_t i = 0; i < vFiles.size() && iTotal > m_iCacheLimit; i++)
+    {
+        if (unlink(vFiles[i].second.c_str()) == 0)
+            iTotal -= vSizes[vFiles[i].second];
+    }
+}
+
+
+// -----------------------------------------------------------------------
+//                                                                VERIFY
+// -----------------------------------------------------------------------
+
+/*
+ * Verifying checks every line of the log: that it is a record at all, with
+ * a timestamp, a known event and, if it has one, a checksum that matches;
+ * and that it makes sense where it is, in time order, with stops and log
+ * messages only while a task is running.  Big logs are split into parts
+ * checked side by side, and what each part can't settle on its own, which
+ * depends on what went before it, is settled once they're all done.
+ *
+ * How much of the log is free of errors is noted in <contract>.verified,
+ * along with the log's inode and a hash of the log just before that point,
+ * and scans don't check the checksums of records there.
+ */
+
+#define STIM_VERIFIED_MAGIC "stim-verified 1"
+
+
+// a part of the log being verified, and its loose ends
+struct TVerifyPart
+{
+    const StimSnapshot* pSnapshot;
+    off_t iFrom;
+    off_t iTo;
+
+    // problems found, with lines numbered from the start of the part
+    unsigned long iLines;
+    vector<TVerifyProblem> vProblems;
+
+    // first and last records, if any
+    bool bRecords;
+    time_t aFirstTime;
+    off_t iFirstOffset;
+    unsigned long iFirstLine;
+    time_t aLastTime;
+
+    // whether there was a start or stop, and if so whether a task was
+    // running at the end
+    bool bTransition;
+    bool bRunning;
+
+    // stops and log messages before any start or stop, which are amiss if
+    // nothing was running when the part began
+    vector<TVerifyProblem> vUnlessRunning;
+};
+
+
+void NoteProblem(
+    vector<TVerifyProblem>& vProblems, 
+    const TLogLine& tLine, 
+    unsigned long iLine, 
+    bool bError, 
+    const string& sProblem)
+{
+    TVerifyProblem tProblem;
+    tProblem.iLine = iLine;
+    tProblem.iOffset = tLine.iOffset;
+    tProblem.bError = bError;
+    tProblem.sProblem = sProblem;
+    vProblems.push_back(tProblem);
+}
+
+
+bool ProblemBefore(const TVerifyProblem& tFirst, const TVerifyProblem& tSecond)
+{
+    return tFirst.iOffset < tSecond.iOffset;
+}
+
+
+// thread body: check each line of a part on its own merits
+void* VerifyPart(void* pArg)
+{
+    TVerifyPart& tPart = *(TVerifyPart*) pArg;
+    const char* pData = tPart.pSnapshot->Data();
+    off_t iPos = tPart.iFrom;
+    TLogLine tLine;
+    TLogRecord tRecord;
+    while (iPos < tPart.iTo)
+    {
+        tLine.pText = pData + iPos;
+        tLine.iOffset = iPos;
+        const char* pNewline = (const char*) memchr(tLine.pText, '\n', tPart.iTo - iPos);
+        tLine.iLength = (pNewline ? pNewline - tLine.pText : tPart.iTo - iPos);
+        iPos += tLine.iLength + 1;
+        unsigned long iLine = ++tPart.iLines;
+
+        // can it be read at all?
+        size_t iLength = tLine.iLength;
+        const char* szError = NULL;
+        if (pNewline == NULL)
+            szError = "unterminated line";
+        else if (iLength == 0)
+            szError = "empty line";
+        else if (iLength < 17 || !DecodeTimestamp(tLine.pText, tRecord.aTime))
+            szError = "bad timestamp";
+        else if (iLength < STIM_MIN_RECORD || tLine.pText[17] != ' ')
+            szError = "no event after timestamp";
+        else if (CheckChecksum(tLine.pText, iLength) < 0)
+            szError = "checksum doesn't match";
+        if (szError != NULL)
+        {
+            NoteProblem(tPart.vProblems, tLine, iLine, true, szError);
+            continue;
+        }
 
-          // new time; new session?
-          if (sEvent == STIM_TASK_START)
-          {
-            tCurrentTimeChunk.aStartTime = tTimeStamp;
-            tCurrentTimeChunk.sTaskPath = sDetail;
-          }
-          //else
-          //  throw "Stim::ReportTime: somehow continued nonexistent session";
+        DecodeRecord(tLine, tRecord, false);
+        if (tRecord.eEvent == STIM_EVENT_UNKNOWN)
+        {
+            const char* pEvent = tLine.pText + 18;
+            const char* pSpace = (const char*) memchr(pEvent, ' ', tLine.pText + iLength - pEvent);
+            NoteProblem(tPart.vProblems, tLine, iLine, true, 
+                "unknown event \"" + string(pEvent, pSpace ? pSpace : tLine.pText + iLength) + "\"");
+            continue;
+        }
+
+        // does it make sense where it is?
+        if (!tPart.bRecords)
+        {
+            tPart.bRecords = true;
+            tPart.aFirstTime = tRecord.aTime;
+            tPart.iFirstOffset = tLine.iOffset;
+            tPart.iFirstLine = iLine;
         }
+        else if (tRecord.aTime < tPart.aLastTime)
+            NoteProblem(tPart.vProblems, tLine, iLine, false, 
+                "earlier than the record before it");
+        tPart.aLastTime = tRecord.aTime;
 
-        // more records for current chunk of time
+        if (tRecord.eEvent == STIM_EVENT_START)
+        {
+            if (tRecord.iDetailLength == 0)
+                NoteProblem(tPart.vProblems, tLine, iLine, false, "start with no task");
+            tPart.bTransition = true;
+            tPart.bRunning = true;
+        }
         else
         {
-          // are we logging something for the task?
-          if (sEvent == STIM_TASK_LOG)
-          {
-            TLogEntry tLogEntry = { tTimeStamp, sDetail };
-            tCurrentTimeChunk.vLogMessages.push_back(tLogEntry);
-          }
-          else // assume we're stopping (or starting a new task)
-          {
-            // assign stop time
-            tCurrentTimeChunk.aStopTime = tTimeStamp;
+            const char* szProblem = (tRecord.eEvent == STIM_EVENT_STOP 
+                ? "stop with nothing running" : "log message with nothing running");
+            if (!tPart.bTransition)
+                NoteProblem(tPart.vUnlessRunning, tLine, iLine, false, szProblem);
+            else if (!tPart.bRunning)
+                NoteProblem(tPart.vProblems, tLine, iLine, false, szProblem);
+            if (tRecord.eEvent == STIM_EVENT_STOP)
+            {
+                tPart.bTransition = true;
+                tPart.bRunning = false;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+bool Stim::Verify(vector<TVerifyProblem>& vProblems, unsigned long& iLines)
+{
+    this->EnsureInitialised();
+    StimSnapshot tSnapshot(m_sStimLog);
+    m_tStats.Switch(STIM_PHASE_PARSE);
+
+    // a part per processor, as long as they're big enough, each starting
+    // at the start of a line
+    long iProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t iParts = tSnapshot.Size() / STIM_VERIFY_PART;
+    if (iParts > (size_t) iProcessors)
+        iParts = iProcessors;
+    if (iParts > STIM_VERIFY_THREADS)
+        iParts = STIM_VERIFY_THREADS;
+    if (iParts < 1)
+        iParts = 1;
+
+    vector<TVerifyPart> vParts(iParts);
+    off_t iFrom = 0;
+    for (size_t i = 0; i < iParts; i++)
+    {
+        TVerifyPart& tPart = vParts[i];
+        tPart.pSnapshot = &tSnapshot;
+        tPart.iFrom = iFrom;
+        tPart.iTo = (i + 1 == iParts ? tSnapshot.Size() 
+            : tSnapshot.LineStartFrom(tSnapshot.Size() / iParts * (i + 1)));
+        tPart.iLines = 0;
+        tPart.bRecords = false;
+        tPart.bTransition = false;
+        tPart.bRunning = false;
+        iFrom = tPart.iTo;
+    }
+
+    if (m_bTrace)
+    {
+        char szMessage[64];
+        snprintf(szMessage, sizeof(szMessage), "Verifying in %lu parts", (unsigned long) iParts);
+        Trace(szMessage);
+    }
+    vector<pthread_t> vThreads(iParts);
+    vector<bool> vThreaded(iParts, false);
+    for (size_t i = 1; i < iParts; i++)
+        vThreaded[i] = (pthread_create(&vThreads[i], NULL, VerifyPart, &vParts[i]) == 0);
 
-            // add time record to vector thereof
-            vTimeSpent.push_back(tCurrentTimeChunk);
+    // any part that can't have a thread is done here instead
+    for (size_t i = 0; i < iParts; i++)
+    {
+        if (!vThreaded[i])
+            VerifyPart(&vParts[i]);
+    }
+    for (size_t i = 1; i < iParts; i++)
+    {
+        if (vThreaded[i])
+            pthread_join(vThreads[i], NULL);
+    }
 
-            // reset time record
-            tCurrentTimeChunk.vLogMessages.clear();
-            if (sEvent == STIM_TASK_START)
+    // tie the parts together: nothing is running at the start of the log
+    m_tStats.Switch(STIM_PHASE_AGGREGATE);
+    vProblems.clear();
+    iLines = 0;
+    bool bRecords = false;
+    time_t aLastTime = 0;
+    bool bRunning = false;
+    for (size_t i = 0; i < iParts; i++)
+    {
+        TVerifyPart& tPart = vParts[i];
+        size_t iFirst = vProblems.size();
+        if (!bRunning)
+            vProblems.insert(vProblems.end(), 
+                tPart.vUnlessRunning.begin(), tPart.vUnlessRunning.end());
+        if (tPart.bRecords)
+        {
+            if (bRecords && tPart.aFirstTime < aLastTime)
             {
-              tCurrentTimeChunk.aStartTime = tTimeStamp;
-              tCurrentTimeChunk.sTaskPath = sDetail;
+                TVerifyProblem tProblem;
+                tProblem.iLine = tPart.iFirstLine;
+                tProblem.iOffset = tPart.iFirstOffset;
+                tProblem.bError = false;
+                tProblem.sProblem = "earlier than the record before it";
+                vProblems.push_back(tProblem);
             }
+            bRecords = true;
+            aLastTime = tPart.aLastTime;
+        }
+        if (tPart.bTransition)
+            bRunning = tPart.bRunning;
+
+        // line numbers so far are the part's own
+        vProblems.insert(vProblems.end(), tPart.vProblems.begin(), tPart.vProblems.end());
+        for (size_t j = iFirst; j < vProblems.size(); j++)
+            vProblems[j].iLine += iLines;
+        iLines += tPart.iLines;
+    }
+    stable_sort(vProblems.begin(), vProblems.end(), ProblemBefore);
+    m_tStats.iLines += iLines;
+    m_tStats.iBytes += tSnapshot.Size();
+
+    // note how far the log is sound; failing to isn't fatal
+    off_t iVerified = tSnapshot.Size();
+    for (size_t i = 0; i < vProblems.size() && iVerified == tSnapshot.Size(); i++)
+    {
+        if (vProblems[i].bError)
+            iVerified = vProblems[i].iOffset;
+    }
+    string sTemp = m_sVerified + ".tmp";
+    FILE* pVerified = fopen(sTemp.c_str(), "w");
+    if (pVerified != NULL)
+    {
+        fprintf(pVerified, STIM_VERIFIED_MAGIC " %lld %lld %016llx\n",
+            (long long) tSnapshot.FileStat().st_ino, (long long) iVerified,
+            TailHash(tSnapshot, iVerified));
+        if (fclose(pVerified) != 0 || rename(sTemp.c_str(), m_sVerified.c_str()) != 0)
+            unlink(sTemp.c_str());
+    }
+
+    return iVerified == tSnapshot.Size();
+}
+
+
+// Take on the verified mark if it was made for this file and the log just
+// before it is as it was.
+void Stim::ReadVerified(StimSnapshot& tSnapshot)
+{
+    FILE* pVerified = fopen(m_sVerified.c_str(), "r");
+    if (pVerified == NULL)
+        return;
+
+    long long iInode, iOffset;
+    unsigned long long iTailHash;
+    if (fscanf(pVerified, STIM_VERIFIED_MAGIC " %lld %lld %llx", 
+            &iInode, &iOffset, &iTailHash) == 3
+        && (ino_t) iInode == tSnapshot.FileStat().st_ino
+        && iOffset <= tSnapshot.Size()
+        && TailHash(tSnapshot, (off_t) iOffset) == iTailHash)
+        tSnapshot.SetVerified((off_t) iOffset);
+    fclose(pVerified);
+}
+
+
+// Drop the verified mark if the log is cut back before it, else make it
+// over to the log as it now is, which may be a new file.
+void Stim::TruncateVerified(ino_t iWasInode, off_t iSize)
+{
+    FILE* pVerified = fopen(m_sVerified.c_str(), "r");
+    if (pVerified == NULL)
+        return;
+
+    long long iInode, iOffset;
+    unsigned long long iTailHash;
+    bool bKeep = (fscanf(pVerified, STIM_VERIFIED_MAGIC " %lld %lld %llx", 
+            &iInode, &iOffset, &iTailHash) == 3 
+        && (ino_t) iInode == iWasInode
+        && iOffset <= iSize);
+    fclose(pVerified);
+
+    struct stat tStat;
+    string sTemp = m_sVerified + ".tmp";
+    FILE* pNew = NULL;
+    if (bKeep && stat(m_sStimLog.c_str(), &tStat) == 0)
+        pNew = fopen(sTemp.c_str(), "w");
+    if (pNew == NULL)
+    {
+        unlink(m_sVerified.c_str());
+        return;
+    }
+    fprintf(pNew, STIM_VERIFIED_MAGIC " %lld %lld %016llx\n",
+        (long long) tStat.st_ino, iOffset, iTailHash);
+    if (fclose(pNew) != 0 || rename(sTemp.c_str(), m_sVerified.c_str()) != 0)
+    {
+        unlink(sTemp.c_str());
+        unlink(m_sVerified.c_str());
+    }
+}
+
+
+// -----------------------------------------------------------------------
+//                                                               QUERIES
+// -----------------------------------------------------------------------
+
+
+StimSnapshot* Stim::OpenSnapshot(void)
+{
+    // make sure containers are initialised
+    this->EnsureInitialised();
+
+    StimSnapshot* pSnapshot = new StimSnapshot(m_sStimLog);
+    ReadVerified(*pSnapshot);
+    return pSnapshot;
+}
+
+
+bool Stim::Status(time_t tNow, TSessionStatus& tSession)
+{
+    this->EnsureInitialised();
+    StimSnapshot tSnapshot(m_sStimLog);
+    off_t iSessionStart = FindSessionStart(tSnapshot);
+    StimCursor tCursor(tSnapshot, &m_tStats, m_bTrace);
+    tCursor.SetReadMode(m_eReadMode);
+    return tCursor.Status(tNow, tSession, iSessionStart);
+}
+
+
+bool Stim::ReportTime(
+  time_t tNow,
+  const string& sDateRange, 
+  vector<string>& vTaskPaths,
+  StimReport& tReport)
+{
+    this->EnsureInitialised();
+    StimSnapshot tSnapshot(m_sStimLog);
+    ReadVerified(tSnapshot);
+
+    // been here before?
+    TCachedResult tResult;
+    if (m_iCacheLimit > 0)
+    {
+        m_tStats.Switch(STIM_PHASE_PARSE);
+        time_t aPeriodStart;
+        DeterminePeriod(tNow, sDateRange, aPeriodStart, tResult.aPeriodEnd);
+        tResult.sKey = CacheKey("chunks", aPeriodStart, tResult.aPeriodEnd, vTaskPaths);
+        if (ReadCache(tSnapshot, tResult))
+        {
+            bool bFound = !tResult.tReport.Empty();
+            if (tReport.Empty())
+                tReport.Swap(tResult.tReport);
             else
-              tCurrentTimeChunk.aStartTime = STIM_TIME_NOTIME;
-          }
+                tReport.Append(tResult.tReport);
+            return bFound;
         }
     }
 
-    // check if we've logged time
-    return !(vTimeSpent.empty());
+    StimCursor tCursor(tSnapshot, &m_tStats, m_bTrace);
+    LimitToActiveDays(tSnapshot, tNow, sDateRange, vTaskPaths, tCursor);
+    tCursor.SetReadMode(m_eReadMode);
+    bool bCache = m_iCacheLimit > 0 && tResult.aPeriodEnd != tNow;
+    StimReport& tFound = bCache ? tResult.tReport : tReport;
+    bool bFound = tCursor.ReportTime(tNow, sDateRange, vTaskPaths, tFound);
+
+    // open-ended ranges end now, so won't be asked for again
+    if (bCache)
+    {
+        if (bFound)
+        {
+            tResult.bClosed = tCursor.ScanClosed();
+            WriteCache(tSnapshot, tResult);
+        }
+        if (tReport.Empty())
+            tReport.Swap(tResult.tReport);
+        else
+            tReport.Append(tResult.tReport);
+    }
+    return bFound;
+}
+
+
+bool Stim::ReportTotals(
+  time_t tNow,
+  const string& sDateRange, 
+  vector<string>& vTaskPaths,
+  map<string, time_t>& vTaskTime)
+{
+    this->EnsureInitialised();
+    StimSnapshot tSnapshot(m_sStimLog);
+    ReadVerified(tSnapshot);
+
+    // been here before?
+    TCachedResult tResult;
+    if (m_iCacheLimit > 0)
+    {
+        m_tStats.Switch(STIM_PHASE_PARSE);
+        time_t aPeriodStart;
+        DeterminePeriod(tNow, sDateRange, aPeriodStart, tResult.aPeriodEnd);
+        tResult.sKey = CacheKey("totals", aPeriodStart, tResult.aPeriodEnd, vTaskPaths);
+        if (ReadCache(tSnapshot, tResult))
+        {
+            for (map<string, time_t>::iterator it = tResult.vTaskTime.begin();
+                it != tResult.vTaskTime.end(); it++)
+                AddToTaskTotals(vTaskTime, it->first, it->second);
+            return !tResult.vTaskTime.empty();
+        }
+    }
+
+    StimCursor tCursor(tSnapshot, &m_tStats, m_bTrace);
+    LimitToActiveDays(tSnapshot, tNow, sDateRange, vTaskPaths, tCursor);
+    tCursor.SetReadMode(m_eReadMode);
+    map<string, time_t>& vFound = (m_iCacheLimit > 0 ? tResult.vTaskTime : vTaskTime);
+    bool bFound = tCursor.ReportTotals(tNow, sDateRange, vTaskPaths, vFound);
+
+    // open-ended ranges end now, so won't be asked for again
+    if (m_iCacheLimit > 0)
+    {
+        for (map<string, time_t>::iterator it = tResult.vTaskTime.begin();
+            it != tResult.vTaskTime.end(); it++)
+            AddToTaskTotals(vTaskTime, it->first, it->second);
+        if (bFound && tResult.aPeriodEnd != tNow)
+        {
+            tResult.bClosed = tCursor.ScanClosed();
+            WriteCache(tSnapshot, tResult);
+        }
+    }
+    return bFound;
+}
+
+
+bool Stim::ReportRecent(
+  size_t iChunks,
+  time_t aSince,
+  vector<string>& vTaskPaths,
+  StimReport& tReport)
+{
+    this->EnsureInitialised();
+    StimSnapshot tSnapshot(m_sStimLog);
+    ReadVerified(tSnapshot);
+    StimCursor tCursor(tSnapshot, &m_tStats, m_bTrace);
+    tCursor.SetReadMode(m_eReadMode);
+    return tCursor.ReportRecent(iChunks, aSince, vTaskPaths, tReport);
+}
+
+
+bool Stim::ReportBuckets(
+  time_t tNow,
+  const string& sDateRange, 
+  vector<string>& vTaskPaths,
+  TStimBucket eBucket,
+  vector<TBucketTotals>& vBuckets)
+{
+    this->EnsureInitialised();
+    StimSnapshot tSnapshot(m_sStimLog);
+    ReadVerified(tSnapshot);
+    StimCursor tCursor(tSnapshot, &m_tStats, m_bTrace);
+    tCursor.SetReadMode(m_eReadMode);
+    LimitToActiveDays(tSnapshot, tNow, sDateRange, vTaskPaths, tCursor);
+    return tCursor.ReportBuckets(tNow, sDateRange, vTaskPaths, eBucket, vBuckets);
 }
 
+
+bool Stim::WorkStats(
+  time_t tNow,
+  const string& sDateRange, 
+  vector<string>& vTaskPaths,
+  TWorkStats& tStats)
+{
+    this->EnsureInitialised();
+    StimSnapshot tSnapshot(m_sStimLog);
+    ReadVerified(tSnapshot);
+    StimCursor tCursor(tSnapshot, &m_tStats, m_bTrace);
+    tCursor.SetReadMode(m_eReadMode);
+    LimitToActiveDays(tSnapshot, tNow, sDateRange, vTaskPaths, tCursor);
+    return tCursor.WorkStats(tNow, sDateRange, vTaskPaths, tStats);
+}
+
+
+bool Stim::TasksAt(vector<TTaskAt>& vQueries)
+{
+    this->EnsureInitialised();
+    StimSnapshot tSnapshot(m_sStimLog);
+    ReadVerified(tSnapshot);
+    StimCursor tCursor(tSnapshot, &m_tStats, m_bTrace);
+    tCursor.SetReadMode(m_eReadMode);
+    return tCursor.TasksAt(vQueries);
+}
+
+
+bool Stim::Tasks(const string& sPrefix, vector<TTaskUse>& vTasks)
+{
+    this->EnsureInitialised();
+    StimSnapshot tSnapshot(m_sStimLog);
+    vector<TTaskUse> vAll;
+    UpdateTaskDictionary(tSnapshot, vAll);
+
+    // those with the prefix are together in the dictionary
+    vTasks.clear();
+    vector<TTaskUse>::const_iterator i = 
+        lower_bound(vAll.begin(), vAll.end(), sPrefix, TaskPathBefore);
+    for (; i != vAll.end() && i->sTaskPath.compare(0, sPrefix.size(), sPrefix) == 0; i++)
+        vTasks.push_back(*i);
+
+    return !vTasks.empty();
+}
+
+
+bool Stim::BeginChunkScan(
+    time_t tNow,
+    const string& sDateRange,
+    vector<string>& vTaskPaths)
+{
+    // scan has a snapshot of its own, kept until the next scan
+    EndChunkScan();
+    m_pScanSnapshot = OpenSnapshot();
+    m_pScanCursor = new StimCursor(*m_pScanSnapshot, &m_tStats, m_bTrace);
+    m_pScanCursor->SetReadMode(m_eReadMode);
+    LimitToActiveDays(*m_pScanSnapshot, tNow, sDateRange, vTaskPaths, *m_pScanCursor);
+
+    return m_pScanCursor->BeginChunkScan(tNow, sDateRange, vTaskPaths);
+}
+
+
+bool Stim::ReadChunk(TTimeChunk& tChunk, bool bLogMessages)
+{
+    if (m_pScanCursor == NULL)
+        return false;
+    return m_pScanCursor->ReadChunk(tChunk, bLogMessages);
+}
+
+
+void Stim::EndChunkScan(void)
+{
+    delete m_pScanCursor;
+    delete m_pScanSnapshot;
+    m_pScanCursor = NULL;
+    m_pScanSnapshot = NULL;
+}
+
+// -----------------------------------------------------------------------
+//                                                              OVERLAPS
+// -----------------------------------------------------------------------
+
+
+StimOverlapScan::StimOverlapScan(const vector<Stim*>& vStims)
+  : m_vStims(vStims)
+{
+}
+
+
+bool StimOverlapScan::Begin(time_t tNow, const string& sDateRange)
+{
+    vector<string> vTaskPaths;
+    m_vNext.assign(m_vStims.size(), TTimeChunk());
+    m_vRunning.assign(m_vStims.size(), TTimeChunk());
+    m_vActive.clear();
+    m_vRunningAt.assign(m_vStims.size(), m_vActive.end());
+    m_vFound.clear();
+    while (!m_qStarts.empty())
+        m_qStarts.pop();
+
+    for (size_t i = 0; i < m_vStims.size(); i++)
+    {
+        if (m_vStims[i]->BeginChunkScan(tNow, sDateRange, vTaskPaths)
+            && m_vStims[i]->ReadChunk(m_vNext[i], false))
+            m_qStarts.push(TStartOf(m_vNext[i].aStartTime, i));
+    }
+    return !m_qStarts.empty();
+}
+
+
+// Take chunks in order of start until one overlaps what's under way on
+// other contracts.  Whatever stops by the time a chunk starts is done with,
+// and whatever is left overlaps it.
+bool StimOverlapScan::Next(TOverlap& tOverlap)
+{
+    while (m_vFound.empty())
+    {
+        if (m_qStarts.empty())
+            return false;
+        size_t iContract = m_qStarts.top().second;
+        m_qStarts.pop();
+        TTimeChunk& tChunk = m_vNext[iContract];
+
+        while (!m_vActive.empty() && m_vActive.begin()->first <= tChunk.aStartTime)
+        {
+            m_vRunningAt[m_vActive.begin()->second] = m_vActive.end();
+            m_vActive.erase(m_vActive.begin());
+        }
+
+        // a log's own chunks don't overlap, but backdated records can
+        // make it look as though they do
+        if (m_vRunningAt[iContract] != m_vActive.end())
+        {
+            m_vActive.erase(m_vRunningAt[iContract]);
+            m_vRunningAt[iContract] = m_vActive.end();
+        }
+
+        for (TActive::iterator it = m_vActive.begin(); it != m_vActive.end(); it++)
+        {
+            const TTimeChunk& tRunning = m_vRunning[it->second];
+            time_t aStop = min(tRunning.aStopTime, tChunk.aStopTime);
+            if (aStop <= tChunk.aStartTime)
+                continue;
+
+            m_vFound.push_back(TOverlap());
+            TOverlap& tFound = m_vFound.back();
+            tFound.aStartTime = tChunk.aStartTime;
+            tFound.aStopTime = aStop;
+            tFound.sFirstContract = m_vStims[it->second]->Contract();
+            tFound.sFirstTask = tRunning.sTaskPath;
+            tFound.sSecondContract = m_vStims[iContract]->Contract();
+            tFound.sSecondTask = tChunk.sTaskPath;
+        }
+
+        // under way now, and on to the contract's next chunk
+        m_vRunning[iContract].aStartTime = tChunk.aStartTime;
+        m_vRunning[iContract].aStopTime = tChunk.aStopTime;
+        m_vRunning[iContract].sTaskPath.swap(tChunk.sTaskPath);
+        m_vRunningAt[iContract] = m_vActive.insert(
+            TActive::value_type(tChunk.aStopTime, iContract));
+        if (m_vStims[iContract]->ReadChunk(tChunk, false))
+            m_qStarts.push(TStartOf(tChunk.aStartTime, iContract));
+    }
+
+    tOverlap = m_vFound.front();
+    m_vFound.pop_front();
+    return true;
+}
+
+
+// -----------------------------------------------------------------------
+//                                                              TIMELINE
+// -----------------------------------------------------------------------
+
+
+StimTimeline::StimTimeline(Stim& tStim)
+  : m_tStim(tStim)
+{
+    m_aStep = 0;
+    m_aStepStart = m_aEnd = 0;
+    m_bChunk = false;
+    m_aChunkAt = STIM_TIME_NOTIME;
+    m_iChunkLogs = 0;
+    m_iStepTasks = 0;
+}
+
+
+bool StimTimeline::Begin(
+    time_t tNow,
+    const string& sDateRange,
+    vector<string>& vTaskPaths,
+    time_t aStep)
+{
+    if (aStep <= 0)
+        throw "Timeline step must be positive";
+    m_aStep = aStep;
+
+    time_t aPeriodStart, aPeriodEnd;
+    DeterminePeriod(tNow, sDateRange, aPeriodStart, aPeriodEnd);
+    m_aEnd = min(aPeriodEnd + 1, tNow);
+    m_aStepStart = aPeriodStart;
+
+    // the first chunk, if any, is needed to place an open-ended grid
+    m_bChunk = m_tStim.BeginChunkScan(tNow, sDateRange, vTaskPaths)
+        && m_tStim.ReadChunk(m_tChunk, true);
+    if (m_bChunk)
+    {
+        m_aChunkAt = m_tChunk.aStartTime;
+        m_iChunkLogs = 0;
+        if (aPeriodStart == 0)
+            m_aStepStart = StartOfBucket(m_tChunk.aStartTime, STIM_BUCKET_DAY);
+    }
+    else if (aPeriodStart == 0)
+        m_aStepStart = m_aEnd;
+
+    return m_aStepStart < m_aEnd;
+}
+
+
+// Spread chunks over the step until one carries on past it or starts after
+// it; that one is kept for the steps that follow.
+bool StimTimeline::Next(TTimelineBucket& tBucket)
+{
+    if (m_aStepStart >= m_aEnd)
+        return false;
+    time_t aStepEnd = m_aStepStart + m_aStep;
+
+    tBucket.aStartTime = m_aStepStart;
+    tBucket.aBusyTime = 0;
+    tBucket.sTaskPath.clear();
+    tBucket.iLogs = 0;
+    m_iStepTasks = 0;
+
+    while (m_bChunk && m_aChunkAt < aStepEnd)
+    {
+        // the chunk's time in this step, by task
+        time_t aUntil = min(min(m_tChunk.aStopTime, aStepEnd), m_aEnd);
+        if (aUntil > m_aChunkAt)
+        {
+            size_t i = 0;
+            while (i < m_iStepTasks && m_vStepTasks[i].first != m_tChunk.sTaskPath)
+                i++;
+            if (i == m_iStepTasks)
+            {
+                if (i == m_vStepTasks.size())
+                    m_vStepTasks.resize(i + 1);
+                m_vStepTasks[i].first = m_tChunk.sTaskPath;
+                m_vStepTasks[i].second = 0;
+                m_iStepTasks++;
+            }
+            m_vStepTasks[i].second += aUntil - m_aChunkAt;
+            tBucket.aBusyTime += aUntil - m_aChunkAt;
+            m_aChunkAt = aUntil;
+        }
+
+        // and its messages
+        const vector<TLogEntry>& vLogs = m_tChunk.vLogMessages;
+        while (m_iChunkLogs < vLogs.size() && vLogs[m_iChunkLogs].aLogTime < aStepEnd)
+        {
+            tBucket.iLogs++;
+            m_iChunkLogs++;
+        }
+
+        if (m_tChunk.aStopTime > aStepEnd || m_iChunkLogs < vLogs.size())
+            break;
+
+        m_bChunk = m_tStim.ReadChunk(m_tChunk, true);
+        m_aChunkAt = m_tChunk.aStartTime;
+        m_iChunkLogs = 0;
+    }
+
+    time_t aMost = 0;
+    for (size_t i = 0; i < m_iStepTasks; i++)
+    {
+        if (m_vStepTasks[i].second > aMost)
+        {
+            aMost = m_vStepTasks[i].second;
+            tBucket.sTaskPath = m_vStepTasks[i].first;
+        }
+    }
+
+    m_aStepStart = aStepEnd;
+    return true;
+}
+
+
 // -----------------------------------------------------------------------
 //                                                               HELPERS
 // -----------------------------------------------------------------------
@@ -758,8 +5144,45 @@ bool Stim::ReportTime(
 
 void Stim::Trace(const char* szMessage)
 {
-#ifdef DEBUG
-    cerr << "STIM>" << szMessage << endl;
-#endif
+    if (m_bTrace)
+        cerr << "STIM>" << szMessage << endl;
+}
+
+
+TStimStats::TStimStats(void)
+{
+    bEnabled = false;
+    for (int i = 0; i < STIM_PHASE_COUNT; i++)
+        adPhaseTime[i] = 0;
+    iLines = iBytes = iRecords = iAllocations = 0;
+    m_ePhase = STIM_PHASE_NONE;
+}
+
+
+void TStimStats::SwitchPhase(TStimPhase eNextPhase)
+{
+    struct timespec tNow;
+    clock_gettime(CLOCK_MONOTONIC, &tNow);
+
+    // charge elapsed time to the phase we're leaving
+    if (m_ePhase != STIM_PHASE_NONE)
+        adPhaseTime[m_ePhase] += (tNow.tv_sec - m_tSince.tv_sec)
+            + (tNow.tv_nsec - m_tSince.tv_nsec) / 1e9;
+
+    m_ePhase = eNextPhase;
+    m_tSince = tNow;
+}
+
+
+const char* TStimStats::PhaseName(int iPhase)
+{
+    static const char* aszNames[STIM_PHASE_COUNT] =
+    {
+        "environment", "seek", "parse", "aggregate", "format", "output"
+    };
+
+    if (iPhase < 0 || iPhase >= STIM_PHASE_COUNT)
+        return "none";
+    return aszNames[iPhase];
 }
 
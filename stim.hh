@@ -6,7 +6,14 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <deque>
+#include <queue>
+#include <stdio.h>
+#include <limits.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
 
 
 //#define DEBUG
@@ -19,7 +26,33 @@
 #define STIM_DATE_TODAY "today"
 #define STIM_DATE_YESTERDAY "yesterday"
 
+// prefixes to a bucket name, as in "thisweek" or "lastmonth"
+#define STIM_DATE_THIS "this"
+#define STIM_DATE_LAST "last"
+
+// records may carry a checksum: a tab, '#' and eight hex digits of the
+// CRC-32 of the record before it
+#define STIM_CHECKSUM_LENGTH 10
+
+// long scans read ahead in buffers of this size, on a thread of their own,
+// when they have at least this much to read that isn't in memory
+#define STIM_PREFETCH_BUFFER (1024 * 1024)
+#define STIM_PREFETCH_MIN (4 * 1024 * 1024)
+
+// verifying splits the log into parts of at least this size, each checked
+// on a thread of its own
+#define STIM_VERIFY_PART (1024 * 1024)
+#define STIM_VERIFY_THREADS 16
+
+// scans limited to the days certain tasks were worked on skip ahead to the
+// next such day when it is at least this far off
+#define STIM_DAYS_SKIP (7 * 24 * 60 * 60)
+
+// chunks are added up in column batches of this many
+#define STIM_COLUMN_BATCH 4096
+
 #define STIM_TIME_NOTIME -1
+#define STIM_TIME_FOREVER ((time_t) LONG_MAX)
 
 
 #define SECONDS_IN_DAY (60 * 60 * 24)
@@ -29,6 +62,7 @@ using namespace std;
 
 
 void GkMakeTimestamp(time_t aTime, char* szDate);
+void GkGrokTimestamp(time_t& aTime, const char* szDate);
 void SecondsToHms(int iSeconds, string& sHms);
 
 struct TLogEntry
@@ -50,7 +84,198 @@ struct TTimeChunk
   }
 };
 
-typedef vector<TTimeChunk> TTimeSpent;
+
+/*
+ * StimArena - memory handed out in order from large blocks and given back
+ * all at once, for results made of many small strings.  Everything handed
+ * out since a mark can be given back too.
+ */
+struct TArenaMark
+{
+  size_t iBlock;
+  size_t iUsed;
+};
+
+class StimArena
+{
+public:
+
+    StimArena(void);
+    ~StimArena(void);
+
+    // a NUL terminated copy of the text
+    const char* Copy(const char* pText, size_t iLength);
+
+    TArenaMark Mark(void) const;
+    void Release(const TArenaMark& tMark);
+
+    // give back everything, keeping the blocks for reuse
+    void Clear(void);
+    void Swap(StimArena& tOther);
+
+private:
+
+    StimArena(const StimArena&);
+    StimArena& operator=(const StimArena&);
+
+    vector<pair<char*, size_t> > m_vBlocks;
+    size_t m_iBlock;
+    size_t m_iUsed;
+};
+
+
+/*
+ * StimReport - the chunks of time found by a report, and their log messages.
+ * Chunks and messages are kept in arrays and their text in an arena, so a
+ * report costs a few large allocations however many chunks it has.  Text is
+ * NUL terminated and lasts as long as the report.
+ */
+struct TReportLog
+{
+  time_t aLogTime;
+  const char* szMessage;
+  size_t iMessageLength;
+};
+
+struct TReportChunk
+{
+  time_t aStartTime;
+  time_t aStopTime;
+  const char* szTaskPath;
+  size_t iTaskPathLength;
+  size_t iFirstLog;       // this chunk's messages in the report
+  size_t iLogCount;
+};
+
+class StimReport
+{
+public:
+
+    StimReport(void) {}
+
+    size_t Size(void) const { return m_vChunks.size(); }
+    bool Empty(void) const { return m_vChunks.empty(); }
+    const TReportChunk& operator[](size_t i) const { return m_vChunks[i]; }
+    const TReportLog& Log(const TReportChunk& tChunk, size_t i) const
+        { return m_vLogs[tChunk.iFirstLog + i]; }
+
+    // building, a chunk at a time; messages go to the last chunk begun
+    void BeginChunk(time_t aStartTime, const char* pTaskPath, size_t iLength);
+    void AddLog(time_t aLogTime, const char* pMessage, size_t iLength);
+    void EndChunk(time_t aStopTime) { m_vChunks.back().aStopTime = aStopTime; }
+
+    // drop the last chunk begun and its messages
+    void DropChunk(void);
+    // drop all but the last so many chunks
+    void KeepLast(size_t iChunks);
+
+    void Append(const StimReport& tOther);
+    void Clear(void);
+    void Swap(StimReport& tOther);
+
+private:
+
+    StimReport(const StimReport&);
+    StimReport& operator=(const StimReport&);
+
+    vector<TReportChunk> m_vChunks;
+    vector<TReportLog> m_vLogs;
+    StimArena m_tArena;
+    TArenaMark m_tChunkMark;    // arena as it was before the last chunk
+};
+
+
+/*
+ * StimChunkColumns - chunks of time as parallel arrays of start times, stop
+ * times and task numbers, so that adding up a great many of them is a few
+ * passes over flat arrays rather than a map insertion each.  Task paths are
+ * numbered as they first turn up, and keep their numbers when the chunks
+ * are cleared, so a long scan can be taken a batch at a time.
+ */
+class StimChunkColumns
+{
+public:
+
+    StimChunkColumns(void) {}
+
+    size_t Size(void) const { return m_vStart.size(); }
+    bool Empty(void) const { return m_vStart.empty(); }
+    size_t Tasks(void) const { return m_vTaskPaths.size(); }
+    const string& TaskPath(size_t iTask) const { return m_vTaskPaths[iTask]; }
+
+    void Add(time_t aStartTime, time_t aStopTime, 
+        const char* pTaskPath, size_t iLength);
+
+    // cut chunks running past the given time short there
+    void Clip(time_t aEnd);
+    // earliest start and latest stop
+    void Span(time_t& aFirst, time_t& aLast) const;
+
+    // add each chunk's time to its task's total, the totals being indexed
+    // by task number and grown to fit
+    void AddTotals(vector<time_t>& vTaskTime) const;
+    // totals for the buckets running from each of the given times to the
+    // next, a row of Tasks() per bucket, splitting chunks across them and
+    // leaving out any time outside them
+    void BucketTotals(const vector<time_t>& vBounds, vector<time_t>& vTaskTime) const;
+
+    // drop the chunks, keeping task numbers
+    void Clear(void);
+
+private:
+
+    StimChunkColumns(const StimChunkColumns&);
+    StimChunkColumns& operator=(const StimChunkColumns&);
+
+    unsigned Intern(const char* pTaskPath, size_t iLength);
+
+    vector<time_t> m_vStart;
+    vector<time_t> m_vStop;
+    vector<unsigned> m_vTask;
+
+    // task paths by number, and an open hash table of their numbers plus
+    // one, nought being a free slot
+    vector<string> m_vTaskPaths;
+    vector<unsigned> m_vSlots;
+};
+
+
+/*
+ * StimDaySet - a set of calendar days, numbered from 1 January 1970 as by
+ * DayNumber(), kept as runs of consecutive days in order.
+ */
+struct TDayRun
+{
+  long iFirst;
+  long iLast;             // inclusive
+};
+
+class StimDaySet
+{
+public:
+
+    StimDaySet(void) {}
+
+    bool Empty(void) const { return m_vRuns.empty(); }
+    size_t Days(void) const;
+    const vector<TDayRun>& Runs(void) const { return m_vRuns; }
+
+    // days are cheapest added in order
+    void Add(long iDay);
+    void Union(const StimDaySet& tOther);
+    void Intersect(const StimDaySet& tOther);
+    void Clip(long iFirst, long iLast);
+    void Clear(void) { m_vRuns.clear(); }
+
+    // as text, runs separated by commas, each its first day and how many
+    // days follow it, like "12345+4,12352+0"
+    void Write(FILE* pFile) const;
+    bool Read(const char* pText, const char* pEnd);
+
+private:
+
+    vector<TDayRun> m_vRuns;
+};
 
 
 /*
@@ -66,6 +291,545 @@ struct TSessionStatus
 };
 
 
+/*
+ * TTaskAt - a moment in time and the chunk of work, if any, going on then
+ */
+struct TTaskAt
+{
+  time_t aWhen;           // moment asked about
+  time_t aStartTime;      // start of chunk, or STIM_TIME_NOTIME if none
+  time_t aStopTime;       // end of chunk, or STIM_TIME_NOTIME if still running
+  string sTaskPath;
+};
+
+
+/*
+ * TTaskUse - a task path as kept in the task dictionary
+ */
+struct TTaskUse
+{
+  string sTaskPath;
+  time_t aLastUsed;       // latest start of the task
+  unsigned long iUses;    // how many times it was started
+};
+
+
+/*
+ * TVacuumStats - what vacuuming a log did, or would do
+ */
+struct TVacuumStats
+{
+  unsigned long iRecords;       // lines in the log beforehand
+  off_t iBytes;                 // size of the log beforehand
+  unsigned long iMergedStarts;  // starts of a task already running that day
+  unsigned long iEmptyChunks;   // starts of chunks that took no time
+  unsigned long iStrayStops;    // stops with nothing running
+  off_t iBytesSaved;
+};
+
+
+// quantile sketch bins grow by this factor, giving answers within a couple
+// of percent, and there are enough of them to reach about a month
+#define STIM_SKETCH_GROWTH 1.05
+#define STIM_SKETCH_BINS 300
+
+/*
+ * TQuantileSketch - approximate quantiles of chunk lengths, kept as counts
+ * in bins of geometrically growing width so its size is fixed however many
+ * chunks go into it
+ */
+struct TQuantileSketch
+{
+  unsigned long iCount;
+  unsigned long aiBins[STIM_SKETCH_BINS];
+
+  TQuantileSketch(void);
+  void Add(time_t aLength);
+  time_t Quantile(double dQuantile) const;
+};
+
+
+#define STIM_LENGTH_BINS 8
+#define STIM_SWITCH_BINS 7
+
+/*
+ * TWorkStats - distributions over the chunks of a period, gathered in one
+ * pass by Add() in time order.  Everything but the per-task sketches is of
+ * fixed size, and those grow only with the number of tasks.
+ */
+struct TWorkStats
+{
+  unsigned long iChunks;
+  time_t aTotal;
+
+  // chunks by length, bounded above by aLengthBounds
+  unsigned long aiLengthChunks[STIM_LENGTH_BINS];
+  time_t aaLengthTime[STIM_LENGTH_BINS];
+
+  // seconds worked by local weekday (Sunday first) and hour of the day
+  time_t aaOccupancy[7][24];
+
+  // days worked by how often the task changed on them, bounded above by
+  // aiSwitchBounds
+  unsigned long iDays;
+  unsigned long iSwitches;
+  unsigned long aiSwitchDays[STIM_SWITCH_BINS];
+
+  map<string, TQuantileSketch> vTaskLengths;
+
+  static const time_t aLengthBounds[STIM_LENGTH_BINS];
+  static const unsigned long aiSwitchBounds[STIM_SWITCH_BINS];
+
+  TWorkStats(void);
+  void Add(const TTimeChunk& tChunk);
+  void Finish(void);    // after the last chunk
+
+private:
+  int m_iDay;           // local day being counted, -1 before the first
+  unsigned long m_iDaySwitches;
+  string m_sLastTask;
+};
+
+
+/*
+ * TBucketTotals - time spent per task over one calendar bucket of a period
+ */
+enum TStimBucket
+{
+  STIM_BUCKET_DAY,
+  STIM_BUCKET_WEEK,       // starting on Monday
+  STIM_BUCKET_MONTH,
+  STIM_BUCKET_QUARTER,
+  STIM_BUCKET_YEAR
+};
+
+struct TBucketTotals
+{
+  time_t aStartTime;
+  time_t aStopTime;       // start of the next bucket, or just after the period
+  map<string, time_t> vTaskTime;
+};
+
+
+/*
+ * TSyncStats - what syncing a log with another copy of it did
+ */
+struct TSyncStats
+{
+  off_t iCommon;                // bytes at the start the copies agree on
+  unsigned long iPulled;        // records taken from the other copy
+  unsigned long iPushed;        // records given to the other copy
+  unsigned long iDuplicates;    // records both had, kept once
+};
+
+
+/*
+ * TVerifyProblem - something amiss with a line of the log.  Errors are lines
+ * that can't be read as records at all; the rest are records that make no
+ * sense where they are, which reports pass over.
+ */
+struct TVerifyProblem
+{
+  unsigned long iLine;          // line number, from 1
+  off_t iOffset;                // byte offset of the line
+  bool bError;
+  string sProblem;
+};
+
+
+/*
+ * TCachedResult - a report as kept in the result cache, along with what's
+ * needed to tell whether it still holds for the log as it is now
+ */
+struct TCachedResult
+{
+  string sKey;
+  ino_t iInode;                 // generation of the log it was made from
+  off_t iSize;
+  time_t aModified;
+  unsigned long long iTailHash;
+  time_t aPeriodEnd;
+  bool bClosed;                 // log carried on past the end of the period
+  StimReport tReport;
+  map<string, time_t> vTaskTime;
+};
+
+
+/*
+ * TStimStats - runtime instrumentation: time spent per phase and volume of
+ * data handled.  Phases are switched rather than nested, so each moment is
+ * charged to exactly one phase; nothing is measured unless enabled.
+ */
+enum TStimPhase
+{
+  STIM_PHASE_NONE = -1,
+  STIM_PHASE_ENVIRONMENT,   // checking and opening the environment
+  STIM_PHASE_SEEK,          // finding the start of the period
+  STIM_PHASE_PARSE,         // reading and decoding records
+  STIM_PHASE_AGGREGATE,     // building chunks and totals
+  STIM_PHASE_FORMAT,        // formatting results
+  STIM_PHASE_OUTPUT,        // writing results
+  STIM_PHASE_COUNT
+};
+
+struct TStimStats
+{
+  bool bEnabled;
+  double adPhaseTime[STIM_PHASE_COUNT];   // seconds spent in each phase
+  unsigned long iLines;                   // lines read from the log
+  unsigned long iBytes;                   // bytes read from the log
+  unsigned long iRecords;                 // records with decoded timestamps
+  unsigned long iAllocations;             // filled in by whoever can count
+
+  TStimStats(void);
+
+  // charge time so far to the current phase and move on to the given one
+  void Switch(TStimPhase eNextPhase)
+  {
+    if (bEnabled)
+      SwitchPhase(eNextPhase);
+  }
+
+  static const char* PhaseName(int iPhase);
+
+private:
+  void SwitchPhase(TStimPhase eNextPhase);
+
+  TStimPhase m_ePhase;
+  struct timespec m_tSince;
+};
+
+
+/*
+ * Log records as decoded from a snapshot.  Text fields point into the
+ * snapshot and are not terminated.
+ */
+enum TStimEvent
+{
+  STIM_EVENT_START,
+  STIM_EVENT_STOP,
+  STIM_EVENT_LOG,
+  STIM_EVENT_UNKNOWN
+};
+
+// how the scan loops read the log
+enum TStimReadMode
+{
+  STIM_READ_AUTO,         // read ahead if it'll help
+  STIM_READ_MAPPED,       // always straight from the mapping
+  STIM_READ_PREFETCH      // always through the read-ahead thread
+};
+
+struct TLogLine
+{
+  const char* pText;      // start of line, excluding newline
+  size_t iLength;
+  off_t iOffset;          // byte offset of line in log
+};
+
+struct TLogRecord
+{
+  time_t aTime;
+  TStimEvent eEvent;
+  const char* pDetail;    // task path or log message, if any
+  size_t iDetailLength;
+  off_t iOffset;          // byte offset of record in log
+};
+
+
+/*
+ * StimSnapshot - an immutable view of a log as it was when the snapshot was
+ * taken, as long as the log is only appended to: the mapping is private
+ * but not a copy, and readers may read the open file rather than the
+ * mapping, so a log truncated or rewritten in place shows through, or
+ * faults if it is cut short.  So anything that rewrites the log, even to
+ * cut off damage at its end, writes a new file and renames it into place,
+ * which leaves the snapshot alone.  A snapshot may be shared by any number
+ * of threads, each querying it through its own StimCursor.
+ */
+class StimSnapshot
+{
+public:
+
+    StimSnapshot(const string& sLogFile);
+    ~StimSnapshot(void);
+
+    const char* Data(void) const { return m_pData; }
+    off_t Size(void) const { return m_iSize; }
+    const struct stat& FileStat(void) const { return m_tStat; }
+    int Descriptor(void) const { return m_iFd; }
+
+    // how much of the log has been verified free of errors, so that its
+    // records needn't have their checksums checked
+    off_t Verified(void) const { return m_iVerified; }
+    void SetVerified(off_t iSize) { m_iVerified = iSize; }
+
+    // whether most of the given range is in memory already
+    bool Resident(off_t iOffset, off_t iLength) const;
+
+    // offset of the first line beginning at or after the given offset
+    off_t LineStartFrom(off_t iOffset) const;
+    // offset of the line ending just before the given offset
+    off_t LineStartBefore(off_t iOffset) const;
+
+private:
+
+    // snapshots own their mapping and are not copied
+    StimSnapshot(const StimSnapshot&);
+    StimSnapshot& operator=(const StimSnapshot&);
+
+    const char* m_pData;
+    off_t m_iSize;
+    struct stat m_tStat;
+    int m_iFd;
+    off_t m_iVerified;
+};
+
+
+/*
+ * StimLineReader - source of log lines for the scan loops.
+ */
+class StimLineReader
+{
+public:
+
+    virtual ~StimLineReader(void) {}
+
+    // position reader at the given offset, reading no further than iEnd
+    virtual void Seek(off_t iOffset, off_t iEnd) = 0;
+    virtual bool NextLine(TLogLine& tLine) = 0;
+};
+
+
+// reads lines straight out of a snapshot's mapping
+class StimMappedLineReader : public StimLineReader
+{
+public:
+
+    StimMappedLineReader(const StimSnapshot& tSnapshot);
+
+    virtual void Seek(off_t iOffset, off_t iEnd);
+    virtual bool NextLine(TLogLine& tLine);
+
+private:
+
+    const StimSnapshot& m_tSnapshot;
+    off_t m_iPos;
+    off_t m_iEnd;
+};
+
+
+// reads lines backwards from the end of a range, for queries about the
+// most recent records; only the pages holding the tail are touched
+class StimReverseLineReader : public StimLineReader
+{
+public:
+
+    StimReverseLineReader(const StimSnapshot& tSnapshot);
+
+    virtual void Seek(off_t iOffset, off_t iEnd);
+    virtual bool NextLine(TLogLine& tLine);
+
+private:
+
+    const StimSnapshot& m_tSnapshot;
+    off_t m_iLow;
+    off_t m_iPos;
+};
+
+
+// reads lines from buffers that a thread of its own fills with pread(), so
+// that waiting for the disk overlaps parsing; for long scans over a log
+// that isn't in memory.  Lines are only good until the next is read.
+class StimPrefetchLineReader : public StimLineReader
+{
+public:
+
+    StimPrefetchLineReader(
+        const StimSnapshot& tSnapshot, 
+        size_t iBufferSize = STIM_PREFETCH_BUFFER);
+    virtual ~StimPrefetchLineReader(void);
+
+    virtual void Seek(off_t iOffset, off_t iEnd);
+    virtual bool NextLine(TLogLine& tLine);
+
+private:
+
+    StimPrefetchLineReader(const StimPrefetchLineReader&);
+    StimPrefetchLineReader& operator=(const StimPrefetchLineReader&);
+
+    static void* Run(void* pReader);
+    void Fill(void);
+    void Start(void);
+    void Stop(void);
+    bool NextBuffer(void);
+
+    const StimSnapshot& m_tSnapshot;
+    size_t m_iBufferSize;
+    off_t m_iEnd;
+
+    // shared with the thread, under the lock: buffers are filled in turn,
+    // and each is handed back once parsed
+    pthread_mutex_t m_tLock;
+    pthread_cond_t m_tChanged;
+    pthread_t m_tThread;
+    bool m_bThread;
+    bool m_bStop;
+    char* m_apBuffer[2];
+    size_t m_aiFilled[2];
+    bool m_abReady[2];
+    int m_iError;
+    off_t m_iFillFrom;
+
+    // parsing position
+    int m_iCurrent;
+    bool m_bDone;
+    size_t m_iSkip;
+    const char* m_pPos;
+    const char* m_pLimit;
+    off_t m_iPos;
+    string m_sCarry;
+};
+
+
+/*
+ * StimCursor - one query's position in, and state over, a snapshot.
+ * Cursors are cheap and are not shared between threads.
+ *
+ * Every query is a pipeline of stages, each pulling from the one before as
+ * it needs to: a line reader yields lines, ReadRecord() decodes them,
+ * ReadChunk() folds records into chunks of time and drops those for tasks
+ * not wanted, and the query itself adds up the chunks it pulls.  No stage
+ * holds more than the item it is working on, so a query over any length of
+ * log takes the same memory, and a new query need only add up chunks.
+ */
+class StimCursor
+{
+public:
+
+    StimCursor(
+        const StimSnapshot& tSnapshot, 
+        TStimStats* pStats = NULL, 
+        bool bTrace = false);
+    virtual ~StimCursor(void);
+
+    // record access; SeekScan() positions the reader for a scan from the
+    // given line start to the end of the log
+    virtual bool ReadRecord(TLogRecord& tRecord, bool bLogDetail = true);
+    void SeekScan(off_t iOffset);
+    virtual bool FindPeriodStart(
+        time_t aPeriodStart,
+        time_t aPeriodEnd);
+
+    // queries; Status starts from the given session start, if known
+    virtual bool Status(
+        time_t tNow, 
+        TSessionStatus& tSession, 
+        off_t iSessionStart = -1);
+    virtual bool BeginChunkScan(
+        time_t tNow,
+        const string& sDateRange,
+        const vector<string>& vTaskPaths);
+    virtual bool BeginTailScan(
+        size_t iChunks,
+        time_t aSince,
+        const vector<string>& vTaskPaths);
+    virtual bool ReadChunk(TTimeChunk& tChunk, bool bLogMessages);
+    virtual bool ReadChunk(StimReport& tReport, bool bLogMessages);
+    virtual bool ReadChunk(StimChunkColumns& tColumns);
+
+    // once a chunk scan has read to the end of the log, the wanted chunk
+    // still running there, if there is one
+    bool RunningChunk(time_t& aStartTime, string& sTaskPath) const;
+    virtual bool ReportTime(
+        time_t tNow,
+        const string& sDateRange, 
+        const vector<string>& vTaskPaths,
+        StimReport& tReport);
+    virtual bool ReportRecent(
+        size_t iChunks,
+        time_t aSince,
+        const vector<string>& vTaskPaths,
+        StimReport& tReport);
+    virtual bool ReportTotals(
+        time_t tNow,
+        const string& sDateRange, 
+        const vector<string>& vTaskPaths,
+        map<string, time_t>& vTaskTime);
+    virtual bool ReportBuckets(
+        time_t tNow,
+        const string& sDateRange, 
+        const vector<string>& vTaskPaths,
+        TStimBucket eBucket,
+        vector<TBucketTotals>& vBuckets);
+    virtual bool WorkStats(
+        time_t tNow,
+        const string& sDateRange, 
+        const vector<string>& vTaskPaths,
+        TWorkStats& tStats);
+    virtual bool TasksAt(vector<TTaskAt>& vQueries);
+
+    // whether the chunk scan stopped at the end of its period, rather than
+    // at the end of the log
+    bool ScanClosed(void) const { return m_bScanClosed; }
+
+    TStimStats& Stats(void) { return *m_pStats; }
+    void SetReadMode(TStimReadMode eMode) { m_eReadMode = eMode; }
+
+    // chunks wanted by a chunk scan only start within these times, in
+    // order, so it may skip what lies between them
+    void SetScanPeriods(const vector<pair<time_t, time_t> >& vPeriods)
+        { m_vScanPeriods = vPeriods; }
+
+protected:
+
+    // offset from which every record is no earlier than the given time;
+    // searching from somewhere other than the start, it gallops forward
+    // first, so the cost goes with how far off the time is
+    off_t BisectTime(time_t aTarget, off_t iFrom = 0);
+
+    bool Tracing(void) const { return m_bTrace; }
+    void Trace(const char* szMessage);
+    void TraceRecord(const TLogRecord& tRecord);
+
+    const StimSnapshot& m_tSnapshot;
+    StimLineReader* m_pReader;
+
+private:
+
+    // readers for seeking about and for long scans
+    StimLineReader* m_pMappedReader;
+    StimLineReader* m_pPrefetchReader;
+    TStimReadMode m_eReadMode;
+
+    // instrumentation, ours unless given someone else's
+    TStimStats m_tOwnStats;
+    TStimStats* m_pStats;
+    bool m_bTrace;
+
+    // chunk scan state, including the chunk under way; a scan reads from
+    // wherever the reader was left
+    void ResetChunkScan(time_t aScanEnd, const vector<string>& vTaskPaths);
+    void BeginScanChunk(const TLogRecord& tRecord);
+    time_t m_aScanStart;
+    string m_sScanTask;
+    bool m_bScanWanted;
+    StimReport m_tScanReport;
+    time_t m_aScanEnd;
+    bool m_bScanMore;
+    bool m_bScanClosed;
+    vector<string> m_vScanTasks;
+    vector<pair<time_t, time_t> > m_vScanPeriods;
+    size_t m_iScanPeriod;
+};
+
+
+/*
+ * Stim - a contract's log.  Queries made through this class take a fresh
+ * snapshot each time; it is not itself meant to be shared between threads.
+ * Take a snapshot with OpenSnapshot() and give each thread its own
+ * StimCursor for that.
+ */
 class Stim
 {
 public:
@@ -87,15 +851,90 @@ public:
     virtual void StopTask(time_t aTime);
     virtual void LogTask(time_t aTime, const string &sMessage);
 
+    // tidy up redundant records, rewriting the log unless a dry run
+    virtual void Vacuum(bool bDryRun, bool bMergeLogs, TVacuumStats& tStats);
+
+    // bring this log and another copy of it, as kept on another machine,
+    // into line with each other
+    virtual void Sync(Stim& tOther, TSyncStats& tStats);
+
+    // check every line of the log, noting how much of it is free of
+    // errors; false if there were any
+    virtual bool Verify(vector<TVerifyProblem>& vProblems, unsigned long& iLines);
+
+    // snapshot of the log as it stands; caller deletes
+    virtual StimSnapshot* OpenSnapshot(void);
+
     // report time spent
     virtual bool Status(time_t tNow, TSessionStatus& tSession);
     virtual bool ReportTime(
         time_t tNow,
         const string& sDateRange, 
         vector<string>& vTaskPaths,
-        TTimeSpent& vTimeSpent);
+        StimReport& tReport);
+    virtual bool ReportTotals(
+        time_t tNow,
+        const string& sDateRange, 
+        vector<string>& vTaskPaths,
+        map<string, time_t>& vTaskTime);
+    virtual bool ReportBuckets(
+        time_t tNow,
+        const string& sDateRange, 
+        vector<string>& vTaskPaths,
+        TStimBucket eBucket,
+        vector<TBucketTotals>& vBuckets);
+    virtual bool ReportRecent(
+        size_t iChunks,
+        time_t aSince,
+        vector<string>& vTaskPaths,
+        StimReport& tReport);
+
+    // how the time in a period was spread about
+    virtual bool WorkStats(
+        time_t tNow,
+        const string& sDateRange, 
+        vector<string>& vTaskPaths,
+        TWorkStats& tStats);
+
+    // what was being worked on at the given moments
+    virtual bool TasksAt(vector<TTaskAt>& vQueries);
 
-    static void Trace(const char* szMessage);
+    // task paths starting with the given prefix, in order, from the task
+    // dictionary
+    virtual bool Tasks(const string& sPrefix, vector<TTaskUse>& vTasks);
+
+    // days in a period on which chunks of any of the given tasks started,
+    // or of all of them, from the day index
+    virtual bool ActiveDays(
+        time_t tNow,
+        const string& sDateRange, 
+        vector<string>& vTaskPaths,
+        bool bAll,
+        StimDaySet& tDays);
+
+    // chunk by chunk reporting, shared by the reporting functions
+    virtual bool BeginChunkScan(
+        time_t tNow,
+        const string& sDateRange,
+        vector<string>& vTaskPaths);
+    virtual bool ReadChunk(TTimeChunk& tChunk, bool bLogMessages);
+
+    // checksum records as they're written
+    void SetChecksums(bool bChecksums) { m_bChecksums = bChecksums; }
+
+    // result cache, used only when given a size limit in bytes
+    void SetCacheLimit(off_t iLimit) { m_iCacheLimit = iLimit; }
+
+    // how queries read the log
+    void SetReadMode(TStimReadMode eMode) { m_eReadMode = eMode; }
+
+    const string& Contract(void) const { return m_sContract; }
+
+    // runtime tracing and instrumentation
+    void SetTracing(bool bTrace) { m_bTrace = bTrace; }
+    bool Tracing(void) const { return m_bTrace; }
+    void Trace(const char* szMessage);
+    TStimStats& Stats(void) { return m_tStats; }
 
 protected:
 
@@ -106,13 +945,70 @@ protected:
         const string& sTimestamp, 
         const string& sEvent, 
         const string& sDetail);
-    virtual bool ReadLog(
-        string& sTimestamp, 
-        string& sEvent, 
-        string& sDetail);
-    virtual bool FindPeriodStart(
+    virtual void EndChunkScan(void);
+    virtual void RecoverTail(void);
+    virtual bool ReplaceLog(off_t iKeep, const string& sTail);
+
+    // session index
+    virtual off_t FindSessionStart(const StimSnapshot& tSnapshot);
+    virtual off_t RebuildSessionIndex(
+        const StimSnapshot& tSnapshot, 
+        off_t iFrom = 0);
+    virtual void NoteSessionStart(time_t aStartTime);
+
+    // task dictionary, brought up to date with the log; from iChanged on,
+    // if given, the log is taken to be new
+    virtual void UpdateTaskDictionary(
+        const StimSnapshot& tSnapshot, 
+        vector<TTaskUse>& vTasks,
+        off_t iChanged = -1);
+
+    // day index, brought up to date with the log likewise, and its use to
+    // let scans for given tasks skip the days they weren't worked on
+    virtual void UpdateDayIndex(
+        const StimSnapshot& tSnapshot, 
+        map<string, StimDaySet>& vDays,
+        off_t iChanged = -1,
+        const vector<string>* pTaskPaths = NULL);
+    virtual void LimitToActiveDays(
+        const StimSnapshot& tSnapshot,
+        time_t tNow,
+        const string& sDateRange, 
+        const vector<string>& vTaskPaths,
+        StimCursor& tCursor);
+
+    // bring sidecar files into line after the log has been rewritten
+    virtual void RebuildIndexes(void);
+
+    // sync: sums of the log's blocks, and replacing the log from an offset
+    // on by way of a journal
+    virtual void ReadBlockSums(
+        const StimSnapshot& tSnapshot, 
+        vector<unsigned long>& vSums);
+    virtual void TruncateBlockSums(ino_t iWasInode, off_t iSize);
+    virtual void ReplaceTail(
+        const StimSnapshot& tSnapshot, 
+        off_t iFrom, 
+        const string& sTail);
+    virtual void FinishSync(void);
+
+    // how much of the log verifying found free of errors
+    virtual void ReadVerified(StimSnapshot& tSnapshot);
+    virtual void TruncateVerified(ino_t iWasInode, off_t iSize);
+
+    // result cache
+    virtual string CacheKey(
+        const char* szKind,
         time_t aPeriodStart,
-        time_t aPeriodEnd);
+        time_t aPeriodEnd,
+        const vector<string>& vTaskPaths);
+    virtual bool ReadCache(
+        const StimSnapshot& tSnapshot, 
+        TCachedResult& tResult);
+    virtual void WriteCache(
+        const StimSnapshot& tSnapshot, 
+        TCachedResult& tResult);
+    virtual void TrimCache(void);
 
 private:
 
@@ -120,18 +1016,177 @@ private:
     string m_sContract;
     bool m_bInitialise;
 
-    // log file
+    // log file, its session index and where damaged records are put
     string m_sStimLog;
     fstream m_fLog;
-    bool m_bLogReadOnly;
+    string m_sSessionIndex;
+    string m_sQuarantine;
+    bool m_bChecksums;
+
+    // distinct task paths, for completion
+    string m_sTaskDictionary;
+
+    // how much of the log has been verified
+    string m_sVerified;
+
+    // days each task was worked on
+    string m_sDayIndex;
+
+    // block sums and journal for syncing with another copy of the log
+    string m_sBlockSums;
+    string m_sSyncJournal;
+
+    // result cache
+    string m_sCacheDir;
+    off_t m_iCacheLimit;
+    TStimReadMode m_eReadMode;
+
+    // tracing and instrumentation
+    bool m_bTrace;
+    TStimStats m_tStats;
+
+    // chunk scan in progress
+    StimSnapshot* m_pScanSnapshot;
+    StimCursor* m_pScanCursor;
+};
+
+
+/*
+ * TOverlap - a stretch of time logged on two contracts at once, the first
+ * being the one whose chunk started first
+ */
+struct TOverlap
+{
+  time_t aStartTime;
+  time_t aStopTime;
+  string sFirstContract;
+  string sFirstTask;
+  string sSecondContract;
+  string sSecondTask;
+};
+
+
+/*
+ * StimOverlapScan - the stretches of a period logged on more than one of
+ * the given contracts at once.  The contracts' chunks are merged in order
+ * of start and swept over, keeping only the chunk each contract has under
+ * way, so memory goes with the number of contracts and not the length of
+ * the period.  Overlaps come out in order of start.
+ */
+class StimOverlapScan
+{
+public:
+
+    StimOverlapScan(const vector<Stim*>& vStims);
+    virtual ~StimOverlapScan(void) {}
+
+    virtual bool Begin(time_t tNow, const string& sDateRange);
+    virtual bool Next(TOverlap& tOverlap);
+
+private:
+
+    typedef pair<time_t, size_t> TStartOf;
+    typedef multimap<time_t, size_t> TActive;
+
+    vector<Stim*> m_vStims;
+
+    // each contract's next chunk, and contracts by when that starts
+    vector<TTimeChunk> m_vNext;
+    priority_queue<TStartOf, vector<TStartOf>, greater<TStartOf> > m_qStarts;
+
+    // each contract's chunk under way, and contracts by when that stops
+    vector<TTimeChunk> m_vRunning;
+    vector<TActive::iterator> m_vRunningAt;
+    TActive m_vActive;
+
+    // overlaps found but not yet returned
+    deque<TOverlap> m_vFound;
+};
+
+
+/*
+ * TTimelineBucket - one step of a timeline: how much of it was worked, on
+ * what mostly, and how many log messages fell in it
+ */
+struct TTimelineBucket
+{
+  time_t aStartTime;
+  time_t aBusyTime;
+  string sTaskPath;       // task with the most time in the step, if any
+  unsigned long iLogs;
+};
+
+
+/*
+ * StimTimeline - a period resampled onto a grid of fixed steps, starting
+ * from the start of the period, or for open-ended ranges from the midnight
+ * before the first chunk, and running to its end or now, whichever is
+ * sooner.  Steps are made as chunks are read, so any length of period
+ * takes the same memory.
+ */
+class StimTimeline
+{
+public:
+
+    StimTimeline(Stim& tStim);
+    virtual ~StimTimeline(void) {}
+
+    virtual bool Begin(
+        time_t tNow,
+        const string& sDateRange,
+        vector<string>& vTaskPaths,
+        time_t aStep);
+    virtual bool Next(TTimelineBucket& tBucket);
+
+private:
+
+    Stim& m_tStim;
+    time_t m_aStep;
+    time_t m_aStepStart;
+    time_t m_aEnd;
+
+    // chunk being spread over the steps, how far it has got and how many
+    // of its messages have been counted
+    TTimeChunk m_tChunk;
+    bool m_bChunk;
+    time_t m_aChunkAt;
+    size_t m_iChunkLogs;
+
+    // time per task in the step under way, in the first so many entries,
+    // which are reused from step to step
+    vector<pair<string, time_t> > m_vStepTasks;
+    size_t m_iStepTasks;
 };
 
 
 // handy helpers
 void AddToTaskTotals(
     map<string, time_t>& vPeriodTime, 
-    string sTask, 
+    const string& sTask, 
     time_t tTimeSpent);
+bool TaskPathMatches(const vector<string>& vTaskPaths, const string& sTask);
+bool StartsNewSession(time_t aLastStop, time_t aStart);
+bool ParseBucket(const string& sName, TStimBucket& eBucket);
+time_t StartOfBucket(time_t aTime, TStimBucket eBucket);
+time_t NextBucket(time_t aStart, TStimBucket eBucket);
+long DayNumber(int iYear, int iMonth, int iDay);
+void DayDate(long iDayNumber, int& iYear, int& iMonth, int& iDay);
+time_t DayStart(long iDayNumber);
+unsigned long StimChecksum(const char* pData, size_t iLength);
+unsigned long long HashBytes(const char* pData, size_t iLength);
+unsigned long long TailHash(const StimSnapshot& tSnapshot, off_t iSize);
+int CheckChecksum(const char* pText, size_t& iLength);
+bool IsTimestamp(const char* pText);
+bool DecodeTimestamp(const char* pText, time_t& aTime);
+bool DecodeRecord(
+    const TLogLine& tLine, 
+    TLogRecord& tRecord, 
+    bool bLogDetail, 
+    bool bVerified = false);
+bool FindLastTransition(
+    const StimSnapshot& tSnapshot, 
+    TLogRecord& tRecord, 
+    off_t iBefore = -1);
 void PrintOutTotals(const string& sStart, map<string, time_t>& vTaskTime);
 
 
@@ -1,6 +1,10 @@
 #include "stim_cli.hh"
 #include "stim.hh"
 
+#include <new>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
 
 using std::string;
 using std::vector;
@@ -13,12 +17,91 @@ const char g_szUsage[] =
 "       stim stop\n"
 "       stim log <message>\n"
 "       stim status [--raw]\n"
-"       stim report <daterange> [taskpath...]\n";
+"       stim export [--format=ndjson|csv|tsv] <daterange> [taskpath...]\n"
+"       stim stats <daterange> [taskpath...]\n"
+"       stim overlaps <daterange>\n"
+"       stim timeline [--step=<relative timespec>] [--format=ndjson|csv|tsv]\n"
+"                     <daterange> [taskpath...]\n"
+"       stim vacuum [--dry-run] [--merge-logs]\n"
+"       stim sync <other home> [contract...]\n"
+"       stim verify\n"
+"       stim at <when>\n"
+"       stim at - < timestamps\n"
+"       stim tasks [--long] [prefix]\n"
+"       stim days [--and|--or] <daterange> <taskpath...>\n"
+"       stim report [--no-summary|--summary-only] <daterange> [taskpath...]\n"
+"       stim report --by=day|week|month|quarter|year <daterange> [taskpath...]\n"
+"       stim report [--no-summary|--summary-only] [--last=N] [--since=<when>]\n"
+"                   [taskpath...]\n"
+"\n"
+"Any command accepts --stats to report timings on standard error.\n";
+
+/*
+** Allocation counting for --stats.  Replacing the global operator new is the
+** only way to see every allocation, including those made by the library.
+*/
+
+static unsigned long g_iAllocations = 0;
+
+// kept out of line, so the compiler doesn't pair the free() in delete with
+// the new at each call site and take them for a mismatch
+__attribute__((noinline)) void* operator new(size_t iSize)
+{
+  // the prefetch and verify threads allocate too
+  __sync_fetch_and_add(&g_iAllocations, 1);
+  void* p = malloc(iSize ? iSize : 1);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p)
+{
+  free(p);
+}
+
+void operator delete(void* p, size_t)
+{
+  operator delete(p);
+}
+
+void* operator new[](size_t iSize)
+{
+  return operator new(iSize);
+}
+
+void operator delete[](void* p)
+{
+  operator delete(p);
+}
+
+void operator delete[](void* p, size_t)
+{
+  operator delete(p);
+}
 
 /*
 ** Helper functions
 */
 
+// report instrumentation on stderr
+void print_stats(TStimStats& tStats)
+{
+  tStats.Switch(STIM_PHASE_NONE);
+  tStats.iAllocations = __sync_fetch_and_add(&g_iAllocations, 0);
+
+  double dTotal = 0;
+  for (int i = 0; i < STIM_PHASE_COUNT; i++)
+  {
+    fprintf(stderr, "stim: %-12s %10.3f ms\n",
+      TStimStats::PhaseName(i), tStats.adPhaseTime[i] * 1000);
+    dTotal += tStats.adPhaseTime[i];
+  }
+  fprintf(stderr, "stim: %-12s %10.3f ms\n", "total", dTotal * 1000);
+  fprintf(stderr, "stim: lines %lu, bytes %lu, records %lu, allocations %lu\n",
+    tStats.iLines, tStats.iBytes, tStats.iRecords, tStats.iAllocations);
+}
+
 // interpret "32m20s" as a number of seconds
 // This is a pretty dorky implementation
 int interpret_relative_timespec(const char* timespec)
@@ -118,7 +201,7 @@ time_t interpret_timespec(time_t tNow, string sWhen)
     }
     else
     { // absolute time
-      time_t tWhen = interpret_absolute_timespec(tNow, sWhen.c_str());
+      tWhen = interpret_absolute_timespec(tNow, sWhen.c_str());
     }
   }
 
@@ -126,6 +209,364 @@ time_t interpret_timespec(time_t tNow, string sWhen)
 }
 
 
+// read the timestamp at the start of a line: seconds since the epoch, as
+// from "git log --format=%ct", or a stim timestamp
+bool interpret_leading_timestamp(const string& sLine, time_t& tWhen)
+{
+  const char* szLine = sLine.c_str();
+  int year, month, day, hours, minutes, seconds;
+  char szDate[18];
+  if (sLine.length() >= 17 && szLine[8] == ' '
+      && sscanf(szLine, "%04d%02d%02d %02d:%02d:%02d", 
+           &year, &month, &day, &hours, &minutes, &seconds) == 6)
+  {
+    strncpy(szDate, szLine, 17);
+    szDate[17] = 0;
+    GkGrokTimestamp(tWhen, szDate);
+    return true;
+  }
+
+  char* szEnd;
+  long iSeconds = strtol(szLine, &szEnd, 10);
+  if (szEnd == szLine || (*szEnd != 0 && !isspace(*szEnd)))
+    return false;
+  tWhen = (time_t) iSeconds;
+  return true;
+}
+
+
+/*
+** Export formats.  Records are serialised by hand into a buffer that is
+** written out as it fills, so exports run in constant memory however long
+** the period.
+*/
+
+enum TExportFormat
+{
+  EXPORT_NDJSON,
+  EXPORT_CSV,
+  EXPORT_TSV
+};
+
+class ExportWriter
+{
+public:
+
+  ExportWriter(FILE* pFile) : m_pFile(pFile), m_iUsed(0) {}
+  ~ExportWriter(void) { Flush(); }
+
+  void Put(char c)
+  {
+    if (m_iUsed == sizeof(m_acBuffer))
+      Flush();
+    m_acBuffer[m_iUsed++] = c;
+  }
+
+  void Put(const char* p, size_t iLength)
+  {
+    if (iLength > sizeof(m_acBuffer) - m_iUsed)
+    {
+      Flush();
+      if (iLength > sizeof(m_acBuffer))
+      {
+        fwrite(p, 1, iLength, m_pFile);
+        return;
+      }
+    }
+    memcpy(m_acBuffer + m_iUsed, p, iLength);
+    m_iUsed += iLength;
+  }
+
+  void Put(const char* sz) { Put(sz, strlen(sz)); }
+
+  void PutNumber(long long iValue)
+  {
+    char szValue[24];
+    Put(szValue, snprintf(szValue, sizeof(szValue), "%lld", iValue));
+  }
+
+  // JSON string, quotes and all
+  void PutJson(const string& s)
+  {
+    Put('"');
+    const char* p = s.data();
+    const char* pEnd = p + s.length();
+    while (p < pEnd)
+    {
+      // copy runs that need no escaping in one go
+      const char* pRun = p;
+      while (p < pEnd && *p != '"' && *p != '\\' && (unsigned char) *p >= 0x20)
+        p++;
+      Put(pRun, p - pRun);
+      if (p == pEnd)
+        break;
+
+      switch (*p)
+      {
+        case '"':  Put("\\\"", 2); break;
+        case '\\': Put("\\\\", 2); break;
+        case '\n': Put("\\n", 2); break;
+        case '\r': Put("\\r", 2); break;
+        case '\t': Put("\\t", 2); break;
+        default:
+        {
+          char szEscape[8];
+          Put(szEscape, snprintf(szEscape, sizeof(szEscape), "\\u%04x", 
+            (unsigned char) *p));
+        }
+      }
+      p++;
+    }
+    Put('"');
+  }
+
+  // CSV field, quoted only if it has to be (RFC 4180)
+  void PutCsv(const string& s)
+  {
+    if (s.find_first_of(",\"\r\n") == string::npos)
+    {
+      Put(s.data(), s.length());
+      return;
+    }
+    Put('"');
+    for (string::const_iterator it = s.begin(); it != s.end(); it++)
+    {
+      if (*it == '"')
+        Put('"');
+      Put(*it);
+    }
+    Put('"');
+  }
+
+  // TSV field, with tabs, newlines and backslashes escaped
+  void PutTsv(const string& s)
+  {
+    for (string::const_iterator it = s.begin(); it != s.end(); it++)
+    {
+      switch (*it)
+      {
+        case '\t': Put("\\t", 2); break;
+        case '\n': Put("\\n", 2); break;
+        case '\r': Put("\\r", 2); break;
+        case '\\': Put("\\\\", 2); break;
+        default:   Put(*it);
+      }
+    }
+  }
+
+  void Flush(void)
+  {
+    if (m_iUsed > 0)
+      fwrite(m_acBuffer, 1, m_iUsed, m_pFile);
+    m_iUsed = 0;
+  }
+
+private:
+
+  FILE* m_pFile;
+  char m_acBuffer[65536];
+  size_t m_iUsed;
+};
+
+
+// NDJSON unless told otherwise
+bool interpret_export_format(const string& sFormat, TExportFormat& eFormat)
+{
+  if (sFormat.empty() || sFormat == "ndjson")
+    eFormat = EXPORT_NDJSON;
+  else if (sFormat == "csv")
+    eFormat = EXPORT_CSV;
+  else if (sFormat == "tsv")
+    eFormat = EXPORT_TSV;
+  else
+    return false;
+  return true;
+}
+
+
+// write one chunk as a record in the given format; log messages are nested
+// in NDJSON and a single field of "<time> <message>" lines in CSV and TSV
+void export_chunk(ExportWriter& tWriter, TExportFormat eFormat, 
+  const TTimeChunk& tChunk, string& sLog)
+{
+  if (eFormat == EXPORT_NDJSON)
+  {
+    tWriter.Put("{\"start\":");
+    tWriter.PutNumber(tChunk.aStartTime);
+    tWriter.Put(",\"stop\":");
+    tWriter.PutNumber(tChunk.aStopTime);
+    tWriter.Put(",\"elapsed\":");
+    tWriter.PutNumber(tChunk.aStopTime - tChunk.aStartTime);
+    tWriter.Put(",\"task\":");
+    tWriter.PutJson(tChunk.sTaskPath);
+    tWriter.Put(",\"log\":[");
+    for (size_t i = 0; i < tChunk.vLogMessages.size(); i++)
+    {
+      tWriter.Put(i ? ",{\"time\":" : "{\"time\":");
+      tWriter.PutNumber(tChunk.vLogMessages[i].aLogTime);
+      tWriter.Put(",\"message\":");
+      tWriter.PutJson(tChunk.vLogMessages[i].sLogMessage);
+      tWriter.Put('}');
+    }
+    tWriter.Put("]}\n");
+    return;
+  }
+
+  char cSeparator = (eFormat == EXPORT_CSV ? ',' : '\t');
+  tWriter.PutNumber(tChunk.aStartTime);
+  tWriter.Put(cSeparator);
+  tWriter.PutNumber(tChunk.aStopTime);
+  tWriter.Put(cSeparator);
+  tWriter.PutNumber(tChunk.aStopTime - tChunk.aStartTime);
+  tWriter.Put(cSeparator);
+
+  sLog.clear();
+  for (size_t i = 0; i < tChunk.vLogMessages.size(); i++)
+  {
+    char szTime[24];
+    snprintf(szTime, sizeof(szTime), i ? "\n%lld " : "%lld ", 
+      (long long) tChunk.vLogMessages[i].aLogTime);
+    sLog += szTime;
+    sLog += tChunk.vLogMessages[i].sLogMessage;
+  }
+
+  if (eFormat == EXPORT_CSV)
+  {
+    tWriter.PutCsv(tChunk.sTaskPath);
+    tWriter.Put(cSeparator);
+    tWriter.PutCsv(sLog);
+  }
+  else
+  {
+    tWriter.PutTsv(tChunk.sTaskPath);
+    tWriter.Put(cSeparator);
+    tWriter.PutTsv(sLog);
+  }
+  tWriter.Put(eFormat == EXPORT_CSV ? "\r\n" : "\n");
+}
+
+
+// write one step of a timeline as a record in the given format
+void export_timeline_bucket(ExportWriter& tWriter, TExportFormat eFormat,
+  const TTimelineBucket& tBucket)
+{
+  if (eFormat == EXPORT_NDJSON)
+  {
+    tWriter.Put("{\"start\":");
+    tWriter.PutNumber(tBucket.aStartTime);
+    tWriter.Put(",\"busy\":");
+    tWriter.PutNumber(tBucket.aBusyTime);
+    tWriter.Put(",\"task\":");
+    tWriter.PutJson(tBucket.sTaskPath);
+    tWriter.Put(",\"logs\":");
+    tWriter.PutNumber(tBucket.iLogs);
+    tWriter.Put("}\n");
+    return;
+  }
+
+  char cSeparator = (eFormat == EXPORT_CSV ? ',' : '\t');
+  tWriter.PutNumber(tBucket.aStartTime);
+  tWriter.Put(cSeparator);
+  tWriter.PutNumber(tBucket.aBusyTime);
+  tWriter.Put(cSeparator);
+  if (eFormat == EXPORT_CSV)
+    tWriter.PutCsv(tBucket.sTaskPath);
+  else
+    tWriter.PutTsv(tBucket.sTaskPath);
+  tWriter.Put(cSeparator);
+  tWriter.PutNumber(tBucket.iLogs);
+  tWriter.Put(eFormat == EXPORT_CSV ? "\r\n" : "\n");
+}
+
+
+// how time was spread about: lengths of chunks, hours of the week worked,
+// task switches per day and chunk lengths by task
+void print_work_stats(const TWorkStats& tStats)
+{
+  static const char* s_aszLengths[STIM_LENGTH_BINS] = {
+    "under 1 minute", "1 to 5 minutes", "5 to 15 minutes", 
+    "15 to 30 minutes", "30 to 60 minutes", "1 to 2 hours", "2 to 4 hours", 
+    "4 hours or more"
+  };
+  static const char* s_aszSwitches[STIM_SWITCH_BINS] = {
+    "none", "1", "2 to 3", "4 to 7", "8 to 15", "16 to 31", "32 or more"
+  };
+  static const char* s_aszDays[7] = {
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+  };
+  string sElapsed;
+
+  SecondsToHms(tStats.aTotal, sElapsed);
+  printf("%lu work periods, %s in total", tStats.iChunks, sElapsed.c_str());
+  SecondsToHms(tStats.aTotal / tStats.iChunks, sElapsed);
+  printf(", %s on average\n", sElapsed.c_str());
+
+  printf("\n  %-21s  %9s  %10s\n", "Length of work period", "periods", "time");
+  for (int i = 0; i < STIM_LENGTH_BINS; i++)
+  {
+    SecondsToHms(tStats.aaLengthTime[i], sElapsed);
+    printf("  %-21s  %9lu  %10s\n", s_aszLengths[i], 
+      tStats.aiLengthChunks[i], sElapsed.c_str());
+  }
+
+  printf("\nHours worked by hour of day\n    ");
+  for (int iDay = 0; iDay < 7; iDay++)
+    printf("  %5s", s_aszDays[iDay]);
+  printf("\n");
+  for (int iHour = 0; iHour < 24; iHour++)
+  {
+    printf("  %02d", iHour);
+    for (int iDay = 0; iDay < 7; iDay++)
+      printf("  %5.1f", tStats.aaOccupancy[iDay][iHour] / 3600.0);
+    printf("\n");
+  }
+
+  printf("\n  %-21s  %6s\n", "Task switches a day", "days");
+  for (int i = 0; i < STIM_SWITCH_BINS; i++)
+    printf("  %-21s  %6lu\n", s_aszSwitches[i], tStats.aiSwitchDays[i]);
+  printf("  %lu switches over %lu days, %.1f a day\n", tStats.iSwitches,
+    tStats.iDays, (double) tStats.iSwitches / tStats.iDays);
+
+  printf("\n%-40s  %7s  %9s  %9s  %9s\n", "Work period length by task", 
+    "periods", "median", "90%", "99%");
+  for (map<string, TQuantileSketch>::const_iterator it = tStats.vTaskLengths.begin();
+    it != tStats.vTaskLengths.end(); it++)
+  {
+    printf("%-40s  %7lu", it->first.c_str(), it->second.iCount);
+    static const double s_adQuantiles[3] = { 0.5, 0.9, 0.99 };
+    for (int i = 0; i < 3; i++)
+    {
+      SecondsToHms(it->second.Quantile(s_adQuantiles[i]), sElapsed);
+      printf("  %9s", sElapsed.c_str());
+    }
+    printf("\n");
+  }
+}
+
+
+// add the contracts with logs in the given home that aren't listed already
+void list_contracts(const string& sHome, vector<string>& vContracts)
+{
+  DIR* pDir = opendir(sHome.c_str());
+  if (pDir == NULL)
+    throw "Failed to read " + sHome;
+
+  struct dirent* pEntry;
+  while ((pEntry = readdir(pDir)) != NULL)
+  {
+    string sName = pEntry->d_name;
+    if (sName.size() <= 4 || sName[0] == '.'
+        || sName.compare(sName.size() - 4, 4, ".log") != 0)
+      continue;
+    sName.erase(sName.size() - 4);
+    if (find(vContracts.begin(), vContracts.end(), sName) == vContracts.end())
+      vContracts.push_back(sName);
+  }
+  closedir(pDir);
+  sort(vContracts.begin(), vContracts.end());
+}
+
+
 int main(int argc, char** argv)
 {
     int iStatus;
@@ -231,6 +672,36 @@ int main(int argc, char** argv)
           // ensure Stim environment
           Stim cStim(sStimDirectory.c_str(), sContract.c_str());
 
+          // runtime tracing and instrumentation
+          if (getenv(STIM_ENV_TRACE))
+            cStim.SetTracing(true);
+          const char* szStats = getenv(STIM_ENV_STATS);
+          if (!vOptions["stats"].empty() 
+              || (szStats != NULL && strcmp(szStats, "0") != 0))
+            cStim.Stats().bEnabled = true;
+
+          // checksum records as they're written
+          const char* szChecksum = getenv(STIM_ENV_CHECKSUM);
+          if (szChecksum != NULL && strcmp(szChecksum, "0") != 0)
+            cStim.SetChecksums(true);
+
+          // result cache, limited to so many kilobytes
+          const char* szCache = getenv(STIM_ENV_CACHE);
+          if (szCache != NULL)
+            cStim.SetCacheLimit((off_t) strtol(szCache, NULL, 10) * 1024);
+
+          // read-ahead for long scans, normally decided by the scan
+          const char* szReader = getenv(STIM_ENV_READER);
+          if (szReader != NULL && *szReader != '\0')
+          {
+            if (strcmp(szReader, "mapped") == 0)
+              cStim.SetReadMode(STIM_READ_MAPPED);
+            else if (strcmp(szReader, "prefetch") == 0)
+              cStim.SetReadMode(STIM_READ_PREFETCH);
+            else if (strcmp(szReader, "auto") != 0)
+              throw "STIM_READER must be auto, mapped or prefetch";
+          }
+
           // handle Stim command
           if (sCommand == "start")
           {
@@ -288,6 +759,7 @@ int main(int argc, char** argv)
               bool bHaveResults = cStim.Status(tNow, tSession);
 
               // report
+              cStim.Stats().Switch(STIM_PHASE_OUTPUT);
               if (bRaw)
               {
                 if (!bHaveResults)
@@ -349,65 +821,494 @@ int main(int argc, char** argv)
                 }
               }
           }
+          else if (sCommand == "at")
+          {
+              // syntax: at <when>
+              //     or at -, reading lines starting with timestamps
+              if (vArgs.size() != 1)
+                  throw "Usage: at <when>";
+
+              if (vArgs[0] != "-")
+              {
+                vector<TTaskAt> vQueries(1);
+                vQueries[0].aWhen = interpret_timespec(tNow, vArgs[0]);
+                if (cStim.TasksAt(vQueries))
+                {
+                  cStim.Stats().Switch(STIM_PHASE_OUTPUT);
+                  cout << vQueries[0].sTaskPath << endl;
+                }
+                else
+                {
+                  std::cerr << "Nothing running." << std::endl;
+                  iStatus = STIM_CLI_RETURN_NO_RESULTS;
+                }
+              }
+              else
+              {
+                // annotate each line with the task, in the order given
+                cStim.Stats().Switch(STIM_PHASE_PARSE);
+                vector<string> vLines;
+                vector<TTaskAt> vQueries;
+                string sLine;
+                while (getline(std::cin, sLine))
+                {
+                  TTaskAt tQuery;
+                  if (sLine.empty())
+                    continue;
+                  if (!interpret_leading_timestamp(sLine, tQuery.aWhen))
+                    throw string("Invalid timestamp: ") + sLine;
+                  vLines.push_back(sLine);
+                  vQueries.push_back(tQuery);
+                }
+
+                if (!cStim.TasksAt(vQueries))
+                  iStatus = STIM_CLI_RETURN_NO_RESULTS;
+
+                cStim.Stats().Switch(STIM_PHASE_OUTPUT);
+                for (size_t i = 0; i < vLines.size(); i++)
+                  cout << vLines[i] << '\t' << vQueries[i].sTaskPath << '\n';
+              }
+          }
+          else if (sCommand == "tasks")
+          {
+              // syntax: tasks [--long] [prefix]
+              if (vArgs.size() > 1)
+                  throw "Usage: tasks [--long] [prefix]";
+              string sPrefix = vArgs.empty() ? "" : vArgs[0];
+
+              vector<TTaskUse> vTasks;
+              if (cStim.Tasks(sPrefix, vTasks))
+              {
+                cStim.Stats().Switch(STIM_PHASE_OUTPUT);
+                bool bLong = !vOptions["long"].empty();
+                char szTimestamp[255];
+                for (size_t i = 0; i < vTasks.size(); i++)
+                {
+                  if (bLong)
+                  {
+                    strftime(szTimestamp, 255, 
+                      szTimestampFormat, localtime(&vTasks[i].aLastUsed));
+                    printf("%s %6lu  %s\n", 
+                      szTimestamp, vTasks[i].iUses, vTasks[i].sTaskPath.c_str());
+                  }
+                  else
+                    printf("%s\n", vTasks[i].sTaskPath.c_str());
+                }
+              }
+              else
+              {
+                  std::cerr << "Nothing to report." << std::endl;
+                  iStatus = STIM_CLI_RETURN_NO_RESULTS;
+              }
+          }
+          else if (sCommand == "days")
+          {
+              // syntax: days [--and|--or] <daterange> <taskpath...>
+              bool bAll = !vOptions["and"].empty();
+              if (vArgs.size() < 2 || (bAll && !vOptions["or"].empty()))
+                  throw "Usage: days [--and|--or] <daterange> <taskpath...>";
+              string sDateRange = vArgs[0];
+              vector<string> vTaskPaths(vArgs.begin() + 1, vArgs.end());
+
+              StimDaySet tDays;
+              if (cStim.ActiveDays(tNow, sDateRange, vTaskPaths, bAll, tDays))
+              {
+                cStim.Stats().Switch(STIM_PHASE_OUTPUT);
+                for (size_t i = 0; i < tDays.Runs().size(); i++)
+                {
+                  for (long iDay = tDays.Runs()[i].iFirst; 
+                    iDay <= tDays.Runs()[i].iLast; iDay++)
+                  {
+                    int iYear, iMonth, iDayOfMonth;
+                    DayDate(iDay, iYear, iMonth, iDayOfMonth);
+                    printf("%04d%02d%02d\n", iYear, iMonth, iDayOfMonth);
+                  }
+                }
+              }
+              else
+              {
+                  std::cerr << "Nothing to report." << std::endl;
+                  iStatus = STIM_CLI_RETURN_NO_RESULTS;
+              }
+          }
+          else if (sCommand == "export")
+          {
+              // syntax: export [--format=ndjson|csv|tsv] <daterange> [taskpath...]
+              if (vArgs.size() < 1)
+                  throw "Usage: export [--format=ndjson|csv|tsv] <daterange> [taskpath...]";
+              string sDateRange = vArgs[0];
+              vector<string> vTaskPaths(vArgs.begin() + 1, vArgs.end());
+
+              TExportFormat eFormat;
+              if (!interpret_export_format(vOptions["format"], eFormat))
+                throw "Usage: export [--format=ndjson|csv|tsv] <daterange> [taskpath...]";
+
+              // stream chunks straight out as they're read
+              ExportWriter tWriter(stdout);
+              if (eFormat == EXPORT_CSV)
+                tWriter.Put("start,stop,elapsed,task,log\r\n");
+              else if (eFormat == EXPORT_TSV)
+                tWriter.Put("start\tstop\telapsed\ttask\tlog\n");
+
+              TTimeChunk tChunk;
+              string sLog;
+              bool bFound = false;
+              if (cStim.BeginChunkScan(tNow, sDateRange, vTaskPaths))
+              {
+                while (cStim.ReadChunk(tChunk, true))
+                {
+                  cStim.Stats().Switch(STIM_PHASE_FORMAT);
+                  export_chunk(tWriter, eFormat, tChunk, sLog);
+                  bFound = true;
+                }
+              }
+
+              cStim.Stats().Switch(STIM_PHASE_OUTPUT);
+              tWriter.Flush();
+              if (!bFound)
+              {
+                  std::cerr << "Nothing to report." << std::endl;
+                  iStatus = STIM_CLI_RETURN_NO_RESULTS;
+              }
+          }
+          else if (sCommand == "stats")
+          {
+              // syntax: stats <daterange> [taskpath...]
+              if (vArgs.size() < 1)
+                  throw "Usage: stats <daterange> [taskpath...]";
+              string sDateRange = vArgs[0];
+              vector<string> vTaskPaths(vArgs.begin() + 1, vArgs.end());
+
+              TWorkStats tWork;
+              if (!cStim.WorkStats(tNow, sDateRange, vTaskPaths, tWork))
+              {
+                  std::cerr << "Nothing to report." << std::endl;
+                  iStatus = STIM_CLI_RETURN_NO_RESULTS;
+              }
+              else
+              {
+                cStim.Stats().Switch(STIM_PHASE_OUTPUT);
+                print_work_stats(tWork);
+              }
+          }
+          else if (sCommand == "timeline")
+          {
+              // syntax: timeline [--step=<relative timespec>] 
+              //     [--format=ndjson|csv|tsv] <daterange> [taskpath...]
+              TExportFormat eFormat;
+              if (vArgs.size() < 1 || !interpret_export_format(vOptions["format"], eFormat))
+                  throw "Usage: timeline [--step=<relative timespec>] [--format=ndjson|csv|tsv] <daterange> [taskpath...]";
+              string sDateRange = vArgs[0];
+              vector<string> vTaskPaths(vArgs.begin() + 1, vArgs.end());
+              string sStep = vOptions["step"];
+              time_t aStep = interpret_relative_timespec(sStep.empty() ? "5m" : sStep.c_str());
+
+              // stream steps straight out as they're made
+              ExportWriter tWriter(stdout);
+              if (eFormat == EXPORT_CSV)
+                tWriter.Put("start,busy,task,logs\r\n");
+              else if (eFormat == EXPORT_TSV)
+                tWriter.Put("start\tbusy\ttask\tlogs\n");
+
+              StimTimeline tTimeline(cStim);
+              TTimelineBucket tBucket;
+              bool bFound = false;
+              if (tTimeline.Begin(tNow, sDateRange, vTaskPaths, aStep))
+              {
+                while (tTimeline.Next(tBucket))
+                {
+                  cStim.Stats().Switch(STIM_PHASE_FORMAT);
+                  export_timeline_bucket(tWriter, eFormat, tBucket);
+                  bFound = true;
+                }
+              }
+
+              cStim.Stats().Switch(STIM_PHASE_OUTPUT);
+              tWriter.Flush();
+              if (!bFound)
+              {
+                  std::cerr << "Nothing to report." << std::endl;
+                  iStatus = STIM_CLI_RETURN_NO_RESULTS;
+              }
+          }
+          else if (sCommand == "overlaps")
+          {
+              // syntax: overlaps <daterange>
+              if (vArgs.size() != 1)
+                  throw "Usage: overlaps <daterange>";
+              string sDateRange = vArgs[0];
+
+              // every contract in the home
+              vector<string> vContracts;
+              list_contracts(sStimDirectory, vContracts);
+              vector<Stim*> vStims;
+              for (size_t i = 0; i < vContracts.size(); i++)
+              {
+                vStims.push_back(new Stim(sStimDirectory.c_str(), vContracts[i].c_str()));
+                vStims.back()->SetTracing(cStim.Tracing());
+              }
+
+              StimOverlapScan tScan(vStims);
+              TOverlap tOverlap;
+              time_t aTotal = 0;
+              char szStartTimestamp[255];
+              char szStopTimestamp[255];
+              string sElapsed;
+              if (tScan.Begin(tNow, sDateRange))
+              {
+                while (tScan.Next(tOverlap))
+                {
+                  strftime(szStartTimestamp, 255, 
+                    szTimestampFormat, localtime(&tOverlap.aStartTime));
+                  strftime(szStopTimestamp, 255, 
+                    szTimestampFormat, localtime(&tOverlap.aStopTime));
+                  SecondsToHms(tOverlap.aStopTime - tOverlap.aStartTime, sElapsed);
+                  printf("%s - %s | %s | %s: %s | %s: %s\n", 
+                    szStartTimestamp, szStopTimestamp, sElapsed.c_str(),
+                    tOverlap.sFirstContract.c_str(), tOverlap.sFirstTask.c_str(),
+                    tOverlap.sSecondContract.c_str(), tOverlap.sSecondTask.c_str());
+                  aTotal += tOverlap.aStopTime - tOverlap.aStartTime;
+                }
+              }
+
+              for (size_t i = 0; i < vStims.size(); i++)
+                delete vStims[i];
+
+              if (aTotal == 0)
+              {
+                  std::cerr << "Nothing to report." << std::endl;
+                  iStatus = STIM_CLI_RETURN_NO_RESULTS;
+              }
+              else
+              {
+                SecondsToHms(aTotal, sElapsed);
+                printf("%60s  %s\n", "TOTAL", sElapsed.c_str());
+              }
+          }
+          else if (sCommand == "sync")
+          {
+              // syntax: sync <other home> [contract...]
+              if (vArgs.size() < 1)
+                  throw "Usage: sync <other home> [contract...]";
+              string sOtherHome = vArgs[0];
+              struct stat tStat;
+              if (stat(sOtherHome.c_str(), &tStat) != 0 || !S_ISDIR(tStat.st_mode))
+                  throw sOtherHome + " is not a directory";
+
+              // every contract either side has, unless told which
+              vector<string> vContracts(vArgs.begin() + 1, vArgs.end());
+              if (vContracts.empty())
+              {
+                list_contracts(sStimDirectory, vContracts);
+                list_contracts(sOtherHome, vContracts);
+              }
+
+              for (size_t i = 0; i < vContracts.size(); i++)
+              {
+                Stim cOurs(sStimDirectory.c_str(), vContracts[i].c_str());
+                Stim cTheirs(sOtherHome.c_str(), vContracts[i].c_str());
+                cOurs.SetTracing(cStim.Tracing());
+                cTheirs.SetTracing(cStim.Tracing());
+                cOurs.Initialise();
+                cTheirs.Initialise();
+
+                TSyncStats tSync;
+                cOurs.Sync(cTheirs, tSync);
+                if (tSync.iPulled == 0 && tSync.iPushed == 0)
+                  printf("%s: up to date\n", vContracts[i].c_str());
+                else
+                  printf("%s: %lu records pulled, %lu pushed, %lu already on both\n",
+                    vContracts[i].c_str(), tSync.iPulled, tSync.iPushed, 
+                    tSync.iDuplicates);
+              }
+          }
+          else if (sCommand == "verify")
+          {
+              // syntax: verify
+              if (vArgs.size() > 0)
+                  throw "Usage: verify";
+
+              vector<TVerifyProblem> vProblems;
+              unsigned long iLines;
+              bool bSound = cStim.Verify(vProblems, iLines);
+
+              // as a compiler would, so editors can find them
+              cStim.Stats().Switch(STIM_PHASE_OUTPUT);
+              unsigned long iErrors = 0;
+              for (size_t i = 0; i < vProblems.size(); i++)
+              {
+                if (vProblems[i].bError)
+                  iErrors++;
+                printf("%s.log:%lu: %s: %s (offset %lld)\n", 
+                  sContract.c_str(), vProblems[i].iLine,
+                  vProblems[i].bError ? "error" : "warning",
+                  vProblems[i].sProblem.c_str(), (long long) vProblems[i].iOffset);
+              }
+              printf("%lu lines, %lu errors, %lu warnings\n", 
+                iLines, iErrors, (unsigned long) vProblems.size() - iErrors);
+              if (!bSound)
+                iStatus = STIM_CLI_RETURN_INVALID_LOG;
+          }
+          else if (sCommand == "vacuum")
+          {
+              // syntax: vacuum [--dry-run] [--merge-logs]
+              if (vArgs.size() > 0)
+                  throw "Usage: vacuum [--dry-run] [--merge-logs]";
+              bool bDryRun = !vOptions["dry-run"].empty();
+
+              TVacuumStats tVacuum;
+              cStim.Vacuum(bDryRun, !vOptions["merge-logs"].empty(), tVacuum);
+
+              unsigned long iRemoved = tVacuum.iMergedStarts 
+                + tVacuum.iEmptyChunks + tVacuum.iStrayStops;
+              printf("%8lu repeated starts merged\n", tVacuum.iMergedStarts);
+              printf("%8lu empty chunks dropped\n", tVacuum.iEmptyChunks);
+              printf("%8lu stray stops dropped\n", tVacuum.iStrayStops);
+              printf("%lu of %lu records and %lld of %lld bytes %s\n",
+                iRemoved, tVacuum.iRecords, 
+                (long long) tVacuum.iBytesSaved, (long long) tVacuum.iBytes,
+                bDryRun ? "would be removed" : "removed");
+          }
           else if (sCommand == "report")
           {
             // syntax: report <daterange> [taskpath...]
-            if (vArgs.size() == 0)
-                throw "Usage: report <daterange> [taskpath...]";
-            string sDateRange = vArgs[0];
-
-            // get optional task paths
+            //     or report [--last=N] [--since=<when>] [taskpath...]
+            string sDateRange;
             vector<string> vTaskPaths;
-            if (vArgs.size() > 1)
+            vector<string>::iterator itArgs = vArgs.begin();
+            bool bSummaryOnly = !vOptions["summary-only"].empty();
+
+            // most recent chunks, rather than a date range?
+            size_t iLastChunks = 0;
+            time_t aSince = STIM_TIME_NOTIME;
+            bool bRecent = false;
+            if (!vOptions["last"].empty())
+            {
+              // "--last N" as well as "--last=N"
+              string sLast = vOptions["last"];
+              if (sLast == "yes" && itArgs != vArgs.end())
+                sLast = *itArgs++;
+              iLastChunks = strtoul(sLast.c_str(), NULL, 10);
+              if (iLastChunks == 0)
+                throw "Usage: report --last=N [taskpath...]";
+              bRecent = true;
+            }
+            if (!vOptions["since"].empty())
             {
-                // task path vector = vArgs[1]..vArgs[N]
-                vTaskPaths.assign(vArgs.begin() + 1, vArgs.end());
+              aSince = interpret_timespec(tNow, vOptions["since"]);
+              bRecent = true;
             }
 
-            // get time spent
-            TTimeSpent vTimeSpent;
-            if (!cStim.ReportTime(tNow, sDateRange, vTaskPaths, vTimeSpent))
+            if (!bRecent)
             {
-                std::cerr << "Nothing to report." << std::endl;
-                iStatus = STIM_CLI_RETURN_NO_RESULTS;
+              if (itArgs == vArgs.end())
+                  throw "Usage: report <daterange> [taskpath...]";
+              sDateRange = *itArgs++;
             }
 
-            // iterate through results
-            TTimeSpent::iterator it3;
-            map<string, string>::iterator it4;
-            vector<TLogEntry>::iterator it5;
-            char szStartTimestamp[255];
-            char szStopTimestamp[255];
-            char szLogTimestamp[255];
-            string sElapsed;
-            time_t aElapsed;
-            string sSeparator;
-            map<string, time_t> vPeriodTime;
-            for (it3 = vTimeSpent.begin(); it3 != vTimeSpent.end(); it3++)
+            // get optional task paths
+            vTaskPaths.assign(itArgs, vArgs.end());
+
+            // totals for each day, week and so on through the period?
+            if (!vOptions["by"].empty())
             {
-              strftime(szStartTimestamp, 255, 
-                szTimestampFormat, localtime(&it3->aStartTime));
-              strftime(szStopTimestamp, 255, 
-                szTimestampFormat, localtime(&it3->aStopTime));
+              TStimBucket eBucket;
+              if (bRecent || !ParseBucket(vOptions["by"], eBucket))
+                throw "Usage: report --by=day|week|month|quarter|year <daterange> [taskpath...]";
 
-              // calculate elapsed time
-              aElapsed = it3->aStopTime - it3->aStartTime;
-              
-              // format elapsed time as readable string
-              SecondsToHms(aElapsed, sElapsed);
-              
-              // add to period totals
-              AddToTaskTotals(vPeriodTime, it3->sTaskPath, aElapsed);
+              vector<TBucketTotals> vBuckets;
+              if (!cStim.ReportBuckets(tNow, sDateRange, vTaskPaths, eBucket, vBuckets))
+              {
+                  std::cerr << "Nothing to report." << std::endl;
+                  iStatus = STIM_CLI_RETURN_NO_RESULTS;
+              }
+
+              // each headed by its dates, given as a date range would be
+              cStim.Stats().Switch(STIM_PHASE_OUTPUT);
+              for (size_t i = 0; i < vBuckets.size(); i++)
+              {
+                char szFirst[16], szLast[16];
+                time_t aLast = vBuckets[i].aStopTime - 1;
+                strftime(szFirst, sizeof(szFirst), "%Y%m%d", localtime(&vBuckets[i].aStartTime));
+                strftime(szLast, sizeof(szLast), "%Y%m%d", localtime(&aLast));
+                if (i > 0)
+                  cout << endl;
+                if (strcmp(szFirst, szLast) == 0)
+                  printf("%s\n", szFirst);
+                else
+                  printf("%s-%s\n", szFirst, szLast);
+                PrintOutTotals(sDateRange, vBuckets[i].vTaskTime);
+              }
+            }
+
+            // totals only?  Then don't bother with chunks at all
+            else if (bSummaryOnly && !bRecent)
+            {
+              map<string, time_t> vPeriodTime;
+              if (!cStim.ReportTotals(tNow, sDateRange, vTaskPaths, vPeriodTime))
+              {
+                  std::cerr << "Nothing to report." << std::endl;
+                  iStatus = STIM_CLI_RETURN_NO_RESULTS;
+              }
+              else
+              {
+                cStim.Stats().Switch(STIM_PHASE_OUTPUT);
+                PrintOutTotals(sDateRange, vPeriodTime);
+              }
+            }
+            else
+            {
+              // get time spent
+              StimReport tReport;
+              bool bFound;
+              if (bRecent)
+                bFound = cStim.ReportRecent(iLastChunks, aSince, vTaskPaths, tReport);
+              else
+                bFound = cStim.ReportTime(tNow, sDateRange, vTaskPaths, tReport);
+              if (!bFound)
+              {
+                  std::cerr << "Nothing to report." << std::endl;
+                  iStatus = STIM_CLI_RETURN_NO_RESULTS;
+              }
 
-              string sLogMessages = "";
-              if (!it3->vLogMessages.empty())
+              // iterate through results
+              char szStartTimestamp[255];
+              char szStopTimestamp[255];
+              char szLogTimestamp[255];
+              string sElapsed;
+              time_t aElapsed;
+              string sSeparator;
+              string sTaskPath;
+              map<string, time_t> vPeriodTime;
+              for (size_t iChunk = 0; iChunk < tReport.Size(); iChunk++)
               {
-                it5 = it3->vLogMessages.begin();
-                while (1) // only do comparison (below) once
+                cStim.Stats().Switch(STIM_PHASE_FORMAT);
+                const TReportChunk& tChunk = tReport[iChunk];
+
+                // calculate elapsed time
+                aElapsed = tChunk.aStopTime - tChunk.aStartTime;
+              
+                // add to period totals
+                sTaskPath.assign(tChunk.szTaskPath, tChunk.iTaskPathLength);
+                AddToTaskTotals(vPeriodTime, sTaskPath, aElapsed);
+                if (bSummaryOnly)
+                  continue;
+
+                strftime(szStartTimestamp, 255, 
+                  szTimestampFormat, localtime(&tChunk.aStartTime));
+                strftime(szStopTimestamp, 255, 
+                  szTimestampFormat, localtime(&tChunk.aStopTime));
+
+                // format elapsed time as readable string
+                SecondsToHms(aElapsed, sElapsed);
+
+                string sLogMessages = "";
+                for (size_t iLog = 0; iLog < tChunk.iLogCount; iLog++)
                 {
+                  const TReportLog& tLog = tReport.Log(tChunk, iLog);
                   strftime(szLogTimestamp, 255, 
-                    szTimestampFormat, localtime(&it5->aLogTime));
-                  
+                    szTimestampFormat, localtime(&tLog.aLogTime));
+                
                   // TODO: this should be generalized; create a dictionary
                   // and send it off 
                   string sLogFormat = szLogFormat;
@@ -417,50 +1318,54 @@ int main(int argc, char** argv)
                     sLogFormat.replace(pos, 6, szLogTimestamp);
                   pos = sLogFormat.find("%LOG%");
                   if (pos != string::npos)
-                    sLogFormat.replace(pos, 5, it5->sLogMessage);
+                    sLogFormat.replace(pos, 5, tLog.szMessage, tLog.iMessageLength);
 
                   sLogMessages += sLogFormat;
-                  if (++it5 == it3->vLogMessages.end())
-                    break;
                 }
-              }
 
-              // TODO: this should be generalized; create a dictionary
-              // and send it off 
-              string sFormat = szReportFormat;
-              string::size_type pos;
-              pos = sFormat.find("%BEGIN%");
-              if (pos != string::npos)
-                sFormat.replace(pos, 7, szStartTimestamp);
-              pos = sFormat.find("%END%");
-              if (pos != string::npos)
-                sFormat.replace(pos, 5, szStopTimestamp);
-              pos = sFormat.find("%DETAIL%");
-              if (pos != string::npos)
-                sFormat.replace(pos, 8, it3->sTaskPath.c_str());
-              pos = sFormat.find("%ELAPSED%");
-              if (pos != string::npos)
-                sFormat.replace(pos, 9, sElapsed.c_str());
-              pos = sFormat.find("%LOG%");
-              if (pos != string::npos)
-                sFormat.replace(pos, 5, sLogMessages.c_str());
-              pos = sFormat.find("\\n");
-              if (pos != string::npos)
-                sFormat.replace(pos, 2, "\n");
-              printf("%s", sFormat.c_str());
-              //printf("%s\n", sFormat.c_str());
-            }
+                // TODO: this should be generalized; create a dictionary
+                // and send it off 
+                string sFormat = szReportFormat;
+                string::size_type pos;
+                pos = sFormat.find("%BEGIN%");
+                if (pos != string::npos)
+                  sFormat.replace(pos, 7, szStartTimestamp);
+                pos = sFormat.find("%END%");
+                if (pos != string::npos)
+                  sFormat.replace(pos, 5, szStopTimestamp);
+                pos = sFormat.find("%DETAIL%");
+                if (pos != string::npos)
+                  sFormat.replace(pos, 8, tChunk.szTaskPath);
+                pos = sFormat.find("%ELAPSED%");
+                if (pos != string::npos)
+                  sFormat.replace(pos, 9, sElapsed.c_str());
+                pos = sFormat.find("%LOG%");
+                if (pos != string::npos)
+                  sFormat.replace(pos, 5, sLogMessages.c_str());
+                pos = sFormat.find("\\n");
+                if (pos != string::npos)
+                  sFormat.replace(pos, 2, "\n");
+                cStim.Stats().Switch(STIM_PHASE_OUTPUT);
+                printf("%s", sFormat.c_str());
+                //printf("%s\n", sFormat.c_str());
+              }
             
-            if (!vPeriodTime.empty() && vOptions["no-summary"].empty())
-            {
-              cout << endl;
-              PrintOutTotals(sDateRange, vPeriodTime);
+              if (!vPeriodTime.empty() && vOptions["no-summary"].empty())
+              {
+                cStim.Stats().Switch(STIM_PHASE_OUTPUT);
+                if (!bSummaryOnly)
+                  cout << endl;
+                PrintOutTotals(sDateRange, vPeriodTime);
+              }
             }
           }
           else
           {
               throw ("No such command: " + sCommand).c_str();
           }
+
+          if (cStim.Stats().bEnabled)
+            print_stats(cStim.Stats());
         }
     }
     catch (const string sError)
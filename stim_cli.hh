@@ -7,11 +7,17 @@
 #define STIM_CLI_RETURN_SUCCESS     0
 #define STIM_CLI_RETURN_USAGE_ERROR 1
 #define STIM_CLI_RETURN_NO_RESULTS  2
+#define STIM_CLI_RETURN_INVALID_LOG 3
 
 #define STIM_ENV_HOME "STIM_HOME"
 #define STIM_ENV_CONTRACT "STIM_CONTRACT"
 
 #define STIM_ENV_FAKENOW "STIM_FAKE_TIME"
+#define STIM_ENV_TRACE "STIM_TRACE"
+#define STIM_ENV_STATS "STIM_STATS"
+#define STIM_ENV_CACHE "STIM_CACHE"
+#define STIM_ENV_READER "STIM_READER"
+#define STIM_ENV_CHECKSUM "STIM_CHECKSUM"
 
 #define STIM_ENV_REPORT_FORMAT "STIM_REPORT_FORMAT"
 #define STIM_ENV_TIMESTAMP_FORMAT "STIM_TIMESTAMP_FORMAT"
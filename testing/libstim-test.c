@@ -0,0 +1,109 @@
+/*
+ * libstim-test - exercise the C interface: status and report over a
+ * contract, then record a few events into a scratch contract and read them
+ * back.  Output is compared against libstim-01.expected.
+ *
+ * Usage: libstim-test <stim home> <contract> <now> <scratch home>
+ */
+
+#include "../libstim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+static int fail(stim_handle* handle, const char* what)
+{
+  fprintf(stderr, "%s: %s\n", what, stim_last_error(handle));
+  return 1;
+}
+
+
+static int report(stim_handle* handle, time_t now, const char* range)
+{
+  stim_chunk_t chunk;
+  stim_log_entry_t entry;
+  size_t i;
+  int result;
+
+  stim_cursor* cursor = stim_report_open(handle, now, range, NULL, 0);
+  if (cursor == NULL)
+    return fail(handle, "stim_report_open");
+
+  while ((result = stim_report_next(cursor, &chunk)) > 0)
+  {
+    printf("chunk %ld %ld %s\n",
+      (long) chunk.start_time, (long) chunk.stop_time, chunk.task_path);
+    for (i = 0; i < chunk.log_count; i++)
+    {
+      stim_report_log(cursor, i, &entry);
+      printf("  log %ld %s\n", (long) entry.log_time, entry.message);
+    }
+  }
+  stim_report_close(cursor);
+
+  if (result < 0)
+    return fail(handle, "stim_report_next");
+  return 0;
+}
+
+
+int main(int argc, char** argv)
+{
+  stim_status_t status;
+  stim_handle* handle;
+  time_t now;
+  int i;
+
+  if (argc != 5)
+  {
+    fprintf(stderr, "Usage: libstim-test <home> <contract> <now> <scratch home>\n");
+    return 1;
+  }
+  now = (time_t) atol(argv[3]);
+
+  printf("abi %d\n", stim_abi_version());
+
+  /* the same handle answers repeated queries */
+  handle = stim_open(argv[1], argv[2]);
+  for (i = 0; i < 2; i++)
+  {
+    if (stim_status(handle, now, &status) < 0)
+      return fail(handle, "stim_status");
+    printf("status %ld %ld %ld %s %s\n",
+      (long) status.session_time, (long) status.task_time,
+      (long) status.transition_time,
+      status.running ? "running" : "stopped", status.current_task);
+  }
+  if (report(handle, now, "today"))
+    return 1;
+  stim_close(handle);
+
+  /* record into a scratch environment and read it back */
+  handle = stim_open(argv[4], "scratch");
+  if (stim_init(handle) < 0)
+    return fail(handle, "stim_init");
+  if (stim_start(handle, now - 3600, "Library/Testing") < 0
+      || stim_log(handle, now - 1800, "half way") < 0
+      || stim_start(handle, now - 600, "Library/Reporting") < 0
+      || stim_stop(handle, now - 60) < 0)
+    return fail(handle, "recording");
+  if (report(handle, now, "today"))
+    return 1;
+  if (stim_status(handle, now, &status) < 0)
+    return fail(handle, "stim_status");
+  printf("status %ld %ld %ld %s %s\n",
+    (long) status.session_time, (long) status.task_time,
+    (long) status.transition_time,
+    status.running ? "running" : "stopped", status.current_task);
+  stim_close(handle);
+
+  /* errors come back as -1 with a message */
+  handle = stim_open("/nonexistent", "nothing");
+  if (stim_status(handle, now, &status) != -1)
+    return 1;
+  printf("error %s\n", stim_last_error(handle));
+  stim_close(handle);
+
+  return 0;
+}
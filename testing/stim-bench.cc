@@ -0,0 +1,655 @@
+/*
+ * stim-bench - helpers for the benchmark harness (see bench-all)
+ *
+ *   stim-bench genlog [--years=N] [--tasks=N] [--switches=N] [--logs=F]
+ *                     [--seed=N] [--start=YYYYMMDD]
+ *     Write a synthetic but deterministic log to standard output: every
+ *     working day has --switches task switches spread over --tasks distinct
+ *     tasks, and each chunk of work carries on average --logs log messages.
+ *     The timestamp of the final record is reported on standard error so the
+ *     harness can pin STIM_FAKE_TIME to it.
+ *
+ *   stim-bench time [--repeat=N] [--evict=FILE] <label> <command...>
+ *     Run the command N times and print one tab-separated line with the
+ *     label, repeat count, median and minimum wall time in milliseconds, and
+ *     peak resident set size in kilobytes.  With --evict, FILE is dropped
+ *     from the page cache before each run, for timing reads from disk.
+ *
+ *   stim-bench stages [--repeat=N] <log>
+ *     Time each stage of the query pipeline on its own over the whole log,
+ *     in this process: reading lines, decoding records, building chunks,
+ *     and adding chunks up into per-task totals, a chunk at a time with
+ *     AddToTaskTotals() and a batch at a time in StimChunkColumns.  Each
+ *     stage includes those before it.  Prints a line per stage in the same
+ *     form as "time".
+ *
+ *   stim-bench threads [--threads=N] [--repeat=N] <log>
+ *     Query one snapshot of the log from N threads at once, each through its
+ *     own cursor, half reading the mapping and half reading ahead, and check
+ *     every answer against the same queries run first on their own.  Prints
+ *     how many queries were run and any that disagree; the exit status is 1
+ *     if any did.
+ *
+ *   stim-bench stamps [--count=N] [--seed=N]
+ *     Check DecodeTimestamp() against IsTimestamp() and GkGrokTimestamp()
+ *     over N random timestamps, some damaged, many near changes of daylight
+ *     saving time in the current time zone.  Local times that happen twice
+ *     or not at all may be read either way.  Prints the number checked,
+ *     valid and ambiguous, and any that disagree; the exit status is 1 if
+ *     any did.
+ */
+
+#include "../stim.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <pthread.h>
+
+
+// simple LCG so generated logs don't depend on the C library's rand()
+static unsigned long long g_iSeed = 1;
+
+static unsigned int NextRandom(void)
+{
+    g_iSeed = g_iSeed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned int) (g_iSeed >> 33);
+}
+
+static int RandomBetween(int iLow, int iHigh)
+{
+    return iLow + (int) (NextRandom() % (unsigned int) (iHigh - iLow + 1));
+}
+
+
+static const char* g_aszProjects[] =
+{
+    "General", "Operations", "Project 1", "Project 2", "Project 3",
+    "Infrastructure", "Support", "Research"
+};
+
+static const char* g_aszTasks[] =
+{
+    "Meetings", "Communication", "Development", "Maintenance",
+    "Documentation", "Monitoring", "Requests", "Task X", "Task Y"
+};
+
+static const char* g_aszWords[] =
+{
+    "reviewed", "fixed", "deployed", "discussed", "the", "a", "build",
+    "ticket", "patch", "server", "report", "with", "team", "customer"
+};
+
+#define COUNT(a) (sizeof(a) / sizeof(a[0]))
+
+
+// each task in the pool is a different task path
+static void MakeTaskPath(int iTask, string& sTask)
+{
+    sTask = g_aszProjects[iTask % COUNT(g_aszProjects)];
+    sTask += "/";
+    sTask += g_aszTasks[(iTask / COUNT(g_aszProjects)) % COUNT(g_aszTasks)];
+}
+
+
+static void PrintRecord(time_t aTime, const char* szEvent, const string& sDetail)
+{
+    char szDate[18];
+    GkMakeTimestamp(aTime, szDate);
+    if (sDetail.empty())
+        printf("%s %s\n", szDate, szEvent);
+    else
+        printf("%s %s %s\n", szDate, szEvent, sDetail.c_str());
+}
+
+
+static int GenerateLog(int iYears, int iTasks, int iSwitches, double dLogs,
+    const char* szStart)
+{
+    int iYear, iMonth, iDay;
+    if (sscanf(szStart, "%04d%02d%02d", &iYear, &iMonth, &iDay) != 3)
+    {
+        fprintf(stderr, "stim-bench: bad start date '%s'\n", szStart);
+        return 1;
+    }
+
+    int iPool = COUNT(g_aszProjects) * COUNT(g_aszTasks);
+    time_t aLast = 0;
+    string sTask, sMessage;
+    for (int iDays = 0; iDays < iYears * 365; iDays++)
+    {
+        // start of the working day; mktime sorts out month ends and DST
+        struct tm tTm;
+        memset(&tTm, 0, sizeof(tTm));
+        tTm.tm_year = iYear - 1900;
+        tTm.tm_mon = iMonth - 1;
+        tTm.tm_mday = iDay + iDays;
+        tTm.tm_hour = 8;
+        tTm.tm_min = RandomBetween(0, 59);
+        tTm.tm_isdst = -1;
+        time_t aNow = mktime(&tTm);
+
+        // skip weekends
+        if (tTm.tm_wday == 0 || tTm.tm_wday == 6)
+            continue;
+
+        // today's tasks are drawn from a window of the pool
+        int iFirstTask = RandomBetween(0, iPool - 1);
+
+        // spread the switches over about nine hours
+        int iChunk = (9 * 3600) / (iSwitches > 0 ? iSwitches : 1);
+        for (int iSwitch = 0; iSwitch < iSwitches; iSwitch++)
+        {
+            MakeTaskPath(iFirstTask + RandomBetween(0, iTasks - 1), sTask);
+            PrintRecord(aNow, STIM_TASK_START, sTask);
+
+            // log messages land somewhere inside the chunk
+            int iLength = RandomBetween(iChunk / 2, iChunk * 3 / 2);
+            int iMessages = (int) dLogs;
+            if (RandomBetween(0, 999) < (int) ((dLogs - iMessages) * 1000))
+                iMessages++;
+            time_t aLogTime = aNow;
+            for (int iMessage = 0; iMessage < iMessages; iMessage++)
+            {
+                aLogTime += RandomBetween(1, iLength / (iMessages + 1) + 1);
+                sMessage.clear();
+                for (int iWord = RandomBetween(3, 10); iWord > 0; iWord--)
+                {
+                    if (!sMessage.empty())
+                        sMessage += " ";
+                    sMessage += g_aszWords[RandomBetween(0, COUNT(g_aszWords) - 1)];
+                }
+                PrintRecord(aLogTime, STIM_TASK_LOG, sMessage);
+            }
+            aNow += iLength;
+
+            // the odd break
+            if (RandomBetween(0, 99) < 10)
+            {
+                PrintRecord(aNow, STIM_TASK_STOP, "");
+                aNow += RandomBetween(300, 3600);
+            }
+        }
+
+        PrintRecord(aNow, STIM_TASK_STOP, "");
+        aLast = aNow;
+    }
+
+    fprintf(stderr, "%ld\n", (long) aLast);
+    return 0;
+}
+
+
+// GkGrokTimestamp() once mktime() has last seen the given month, since it
+// guesses the offset of ambiguous times from the last one it worked out
+static time_t GrokAfter(const char* szStamp, int iMonth)
+{
+    struct tm tTm;
+    memset(&tTm, 0, sizeof(tTm));
+    sscanf(szStamp, "%4d", &tTm.tm_year);
+    tTm.tm_year -= 1900;
+    tTm.tm_mon = iMonth;
+    tTm.tm_mday = 1;
+    tTm.tm_hour = 12;
+    tTm.tm_isdst = -1;
+    mktime(&tTm);
+
+    time_t aTime;
+    GkGrokTimestamp(aTime, szStamp);
+    return aTime;
+}
+
+
+static int CheckStamps(int iCount)
+{
+    static const char szNoise[] = "0123456789 :-/\t\x80\xff";
+    int iValid = 0, iAmbiguous = 0, iWrong = 0;
+    char szStamp[18];
+    for (int i = 0; i < iCount; )
+    {
+        // a day's worth at a time, as in a log; often a month when the
+        // clocks change, and now and then a date that doesn't exist
+        int iYear = RandomBetween(1969, 2037);
+        int iMonth = RandomBetween(0, 99) < 40 
+            ? 3 + 7 * RandomBetween(0, 1) + RandomBetween(0, 1)
+            : RandomBetween(0, 99) < 2 ? RandomBetween(0, 13) : RandomBetween(1, 12);
+        int iDay = RandomBetween(0, 99) < 2 ? RandomBetween(0, 35) : RandomBetween(1, 28);
+        for (int iStamps = RandomBetween(1, 20); iStamps > 0 && i < iCount; iStamps--, i++)
+        {
+            bool bNight = RandomBetween(0, 1);
+            snprintf(szStamp, sizeof(szStamp), "%04d%02d%02d %02d:%02d:%02d",
+                iYear, iMonth, iDay, 
+                bNight ? RandomBetween(0, 3) : RandomBetween(0, 23),
+                RandomBetween(0, 99) < 1 ? 60 : RandomBetween(0, 59), 
+                RandomBetween(0, 99) < 1 ? 60 : RandomBetween(0, 59));
+            if (RandomBetween(0, 99) < 5)
+                szStamp[RandomBetween(0, 16)] = 
+                    szNoise[RandomBetween(0, sizeof(szNoise) - 2)];
+
+            bool bExpected = IsTimestamp(szStamp);
+            time_t aExpected = 0, aOtherwise = 0, aTime = 0;
+            if (bExpected)
+            {
+                aExpected = GrokAfter(szStamp, 0);
+                aOtherwise = GrokAfter(szStamp, 6);
+                iValid++;
+                if (aOtherwise != aExpected)
+                    iAmbiguous++;
+            }
+            bool bDecoded = DecodeTimestamp(szStamp, aTime);
+            if (bDecoded != bExpected 
+                || (aTime != aExpected && aTime != aOtherwise))
+            {
+                if (iWrong++ < 10)
+                    printf("wrong: '%s' gave %d %ld, expected %d %ld\n", 
+                        szStamp, bDecoded, (long) aTime, 
+                        bExpected, (long) aExpected);
+            }
+        }
+    }
+
+    printf("%d checked, %d valid, %d ambiguous, %d wrong\n", 
+        iCount, iValid, iAmbiguous, iWrong);
+    return iWrong ? 1 : 0;
+}
+
+
+static double Milliseconds(const struct timeval& tStart, const struct timeval& tEnd)
+{
+    return (tEnd.tv_sec - tStart.tv_sec) * 1000.0
+        + (tEnd.tv_usec - tStart.tv_usec) / 1000.0;
+}
+
+
+// ask the kernel to forget the file's cached pages; it has to be written
+// back first for that to take
+static int EvictFile(const char* szFile)
+{
+    int iFd = open(szFile, O_RDONLY);
+    if (iFd < 0 || fdatasync(iFd) != 0
+        || posix_fadvise(iFd, 0, 0, POSIX_FADV_DONTNEED) != 0)
+    {
+        perror("stim-bench: evict");
+        if (iFd >= 0)
+            close(iFd);
+        return 1;
+    }
+    close(iFd);
+    return 0;
+}
+
+
+static int TimeCommand(int iRepeat, const char* szEvict, const char* szLabel,
+    char** argv)
+{
+    vector<double> vTimes;
+    long iMaxRss = 0;
+    for (int i = 0; i < iRepeat; i++)
+    {
+        if (szEvict != NULL && EvictFile(szEvict) != 0)
+            return 1;
+
+        struct timeval tStart, tEnd;
+        gettimeofday(&tStart, NULL);
+
+        pid_t iPid = fork();
+        if (iPid < 0)
+        {
+            perror("stim-bench: fork");
+            return 1;
+        }
+        if (iPid == 0)
+        {
+            // results go nowhere; we're only interested in the time taken
+            if (freopen("/dev/null", "w", stdout) == NULL)
+                _exit(127);
+            execvp(argv[0], argv);
+            _exit(127);
+        }
+
+        int iStatus;
+        struct rusage tUsage;
+        if (wait4(iPid, &iStatus, 0, &tUsage) < 0)
+        {
+            perror("stim-bench: wait4");
+            return 1;
+        }
+        gettimeofday(&tEnd, NULL);
+
+        if (WIFEXITED(iStatus) && WEXITSTATUS(iStatus) == 127)
+        {
+            fprintf(stderr, "stim-bench: could not run %s\n", argv[0]);
+            return 1;
+        }
+
+        vTimes.push_back(Milliseconds(tStart, tEnd));
+        if (tUsage.ru_maxrss > iMaxRss)
+            iMaxRss = tUsage.ru_maxrss;
+    }
+
+    sort(vTimes.begin(), vTimes.end());
+    printf("%s\t%d\t%.3f\t%.3f\t%ld\n",
+        szLabel, iRepeat, vTimes[vTimes.size() / 2], vTimes[0], iMaxRss);
+    return 0;
+}
+
+
+// run one stage of the pipeline over the whole snapshot, returning how
+// many items it produced
+static unsigned long RunStage(const StimSnapshot& tSnapshot, int iStage)
+{
+    unsigned long iItems = 0;
+    if (iStage == 0)
+    {
+        StimMappedLineReader tReader(tSnapshot);
+        tReader.Seek(0, tSnapshot.Size());
+        TLogLine tLine;
+        while (tReader.NextLine(tLine))
+            iItems++;
+        return iItems;
+    }
+
+    StimCursor tCursor(tSnapshot);
+    tCursor.SetReadMode(STIM_READ_MAPPED);
+    if (iStage == 1)
+    {
+        tCursor.SeekScan(0);
+        TLogRecord tRecord;
+        while (tCursor.ReadRecord(tRecord, false))
+            iItems++;
+        return iItems;
+    }
+
+    vector<string> vTaskPaths;
+    map<string, time_t> vTaskTime;
+    TTimeChunk tChunk;
+    if (!tCursor.BeginChunkScan(STIM_TIME_FOREVER, "-", vTaskPaths))
+        return 0;
+    if (iStage == 4)
+    {
+        StimChunkColumns tColumns;
+        vector<time_t> vTotals;
+        bool bMore = true;
+        while (bMore)
+        {
+            tColumns.Clear();
+            while ((bMore = tCursor.ReadChunk(tColumns)) 
+                && tColumns.Size() < STIM_COLUMN_BATCH)
+                ;
+            tColumns.AddTotals(vTotals);
+            iItems += tColumns.Size();
+        }
+        for (size_t i = 0; i < tColumns.Tasks(); i++)
+            AddToTaskTotals(vTaskTime, tColumns.TaskPath(i), vTotals[i]);
+        return iItems;
+    }
+    while (tCursor.ReadChunk(tChunk, false))
+    {
+        if (iStage == 3)
+            AddToTaskTotals(vTaskTime, tChunk.sTaskPath, 
+                tChunk.aStopTime - tChunk.aStartTime);
+        iItems++;
+    }
+    return iItems;
+}
+
+
+static int TimeStages(int iRepeat, const char* szLog)
+{
+    static const char* aszStages[] = 
+        { "stage-lines", "stage-records", "stage-chunks", "stage-totals",
+          "stage-columns" };
+    StimSnapshot tSnapshot(szLog);
+    for (int iStage = 0; iStage < (int) COUNT(aszStages); iStage++)
+    {
+        vector<double> vTimes;
+        for (int i = 0; i < iRepeat; i++)
+        {
+            struct timeval tStart, tEnd;
+            gettimeofday(&tStart, NULL);
+            if (RunStage(tSnapshot, iStage) == 0)
+            {
+                fprintf(stderr, "stim-bench: nothing in %s\n", szLog);
+                return 1;
+            }
+            gettimeofday(&tEnd, NULL);
+            vTimes.push_back(Milliseconds(tStart, tEnd));
+        }
+
+        struct rusage tUsage;
+        getrusage(RUSAGE_SELF, &tUsage);
+        sort(vTimes.begin(), vTimes.end());
+        printf("%s\t%d\t%.3f\t%.3f\t%ld\n", aszStages[iStage], 
+            iRepeat, vTimes[vTimes.size() / 2], vTimes[0], tUsage.ru_maxrss);
+    }
+    return 0;
+}
+
+
+// a report over the whole snapshot, totals and by month, as text
+static string QueryText(const StimSnapshot& tSnapshot, TStimReadMode eMode)
+{
+    StimCursor tCursor(tSnapshot);
+    tCursor.SetReadMode(eMode);
+    vector<string> vTaskPaths;
+    map<string, time_t> vTaskTime;
+    vector<TBucketTotals> vBuckets;
+    tCursor.ReportTotals(STIM_TIME_FOREVER, "-", vTaskPaths, vTaskTime);
+    tCursor.ReportBuckets(STIM_TIME_FOREVER, "-", vTaskPaths, 
+        STIM_BUCKET_MONTH, vBuckets);
+
+    string sText;
+    char szLine[64];
+    map<string, time_t>::const_iterator it;
+    for (it = vTaskTime.begin(); it != vTaskTime.end(); ++it)
+    {
+        snprintf(szLine, sizeof(szLine), " %ld\n", (long) it->second);
+        sText += it->first + szLine;
+    }
+    for (size_t i = 0; i < vBuckets.size(); i++)
+    {
+        snprintf(szLine, sizeof(szLine), "%ld-%ld\n", 
+            (long) vBuckets[i].aStartTime, (long) vBuckets[i].aStopTime);
+        sText += szLine;
+        for (it = vBuckets[i].vTaskTime.begin(); it != vBuckets[i].vTaskTime.end(); ++it)
+        {
+            snprintf(szLine, sizeof(szLine), " %ld\n", (long) it->second);
+            sText += "  " + it->first + szLine;
+        }
+    }
+    return sText;
+}
+
+
+struct TQueryThread
+{
+  const StimSnapshot* pSnapshot;
+  const string* pExpected;
+  TStimReadMode eMode;
+  int iRepeat;
+  int iWrong;
+};
+
+
+static void* RunQueries(void* pArg)
+{
+    TQueryThread* pThread = (TQueryThread*) pArg;
+    for (int i = 0; i < pThread->iRepeat; i++)
+    {
+        if (QueryText(*pThread->pSnapshot, pThread->eMode) != *pThread->pExpected)
+            pThread->iWrong++;
+    }
+    return NULL;
+}
+
+
+static int CheckThreads(int iThreads, int iRepeat, const char* szLog)
+{
+    StimSnapshot tSnapshot(szLog);
+    string sExpected = QueryText(tSnapshot, STIM_READ_MAPPED);
+    if (sExpected.empty())
+    {
+        fprintf(stderr, "stim-bench: nothing in %s\n", szLog);
+        return 1;
+    }
+
+    vector<TQueryThread> vThreads(iThreads);
+    vector<pthread_t> vIds(iThreads);
+    for (int i = 0; i < iThreads; i++)
+    {
+        vThreads[i].pSnapshot = &tSnapshot;
+        vThreads[i].pExpected = &sExpected;
+        vThreads[i].eMode = (i % 2 == 0) ? STIM_READ_MAPPED : STIM_READ_PREFETCH;
+        vThreads[i].iRepeat = iRepeat;
+        vThreads[i].iWrong = 0;
+        if (pthread_create(&vIds[i], NULL, RunQueries, &vThreads[i]) != 0)
+        {
+            fprintf(stderr, "stim-bench: can't start thread %d\n", i);
+            return 1;
+        }
+    }
+
+    int iWrong = 0;
+    for (int i = 0; i < iThreads; i++)
+    {
+        pthread_join(vIds[i], NULL);
+        if (vThreads[i].iWrong > 0)
+            printf("thread %d: %d of %d wrong\n", i, vThreads[i].iWrong, iRepeat);
+        iWrong += vThreads[i].iWrong;
+    }
+    printf("%d threads, %d queries each, %d wrong\n", iThreads, iRepeat, iWrong);
+    return iWrong > 0 ? 1 : 0;
+}
+
+
+static const char* OptionValue(const char* szArg, const char* szOption)
+{
+    size_t iLen = strlen(szOption);
+    if (strncmp(szArg, szOption, iLen) == 0 && szArg[iLen] == '=')
+        return szArg + iLen + 1;
+    return NULL;
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "genlog") == 0)
+    {
+        int iYears = 1, iTasks = 5, iSwitches = 12;
+        double dLogs = 0.5;
+        const char* szStart = "20100104";
+        const char* szValue;
+        for (int i = 2; i < argc; i++)
+        {
+            if ((szValue = OptionValue(argv[i], "--years")))
+                iYears = atoi(szValue);
+            else if ((szValue = OptionValue(argv[i], "--tasks")))
+                iTasks = atoi(szValue);
+            else if ((szValue = OptionValue(argv[i], "--switches")))
+                iSwitches = atoi(szValue);
+            else if ((szValue = OptionValue(argv[i], "--logs")))
+                dLogs = atof(szValue);
+            else if ((szValue = OptionValue(argv[i], "--seed")))
+                g_iSeed = strtoull(szValue, NULL, 10);
+            else if ((szValue = OptionValue(argv[i], "--start")))
+                szStart = szValue;
+            else
+            {
+                fprintf(stderr, "stim-bench: unknown option '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        if (iTasks < 1)
+            iTasks = 1;
+        return GenerateLog(iYears, iTasks, iSwitches, dLogs, szStart);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "stamps") == 0)
+    {
+        int iCount = 100000;
+        const char* szValue;
+        for (int i = 2; i < argc; i++)
+        {
+            if ((szValue = OptionValue(argv[i], "--count")))
+                iCount = atoi(szValue);
+            else if ((szValue = OptionValue(argv[i], "--seed")))
+                g_iSeed = strtoull(szValue, NULL, 10);
+            else
+            {
+                fprintf(stderr, "stim-bench: unknown option '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        return CheckStamps(iCount);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "stages") == 0)
+    {
+        int iRepeat = 5;
+        const char* szValue;
+        if (argc == 4 && (szValue = OptionValue(argv[2], "--repeat")))
+            iRepeat = atoi(szValue);
+        else if (argc != 3)
+            return 1;
+        if (iRepeat < 1)
+            return 1;
+        return TimeStages(iRepeat, argv[argc - 1]);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "threads") == 0)
+    {
+        int iThreads = 8, iRepeat = 20;
+        const char* szValue;
+        for (int i = 2; i < argc - 1; i++)
+        {
+            if ((szValue = OptionValue(argv[i], "--threads")))
+                iThreads = atoi(szValue);
+            else if ((szValue = OptionValue(argv[i], "--repeat")))
+                iRepeat = atoi(szValue);
+            else
+            {
+                fprintf(stderr, "stim-bench: unknown option '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        if (iThreads < 1 || iRepeat < 1)
+            return 1;
+        return CheckThreads(iThreads, iRepeat, argv[argc - 1]);
+    }
+
+    if (argc >= 4 && strcmp(argv[1], "time") == 0)
+    {
+        int iRepeat = 5;
+        const char* szEvict = NULL;
+        int iArg = 2;
+        const char* szValue;
+        for (; iArg < argc; iArg++)
+        {
+            if ((szValue = OptionValue(argv[iArg], "--repeat")))
+                iRepeat = atoi(szValue);
+            else if ((szValue = OptionValue(argv[iArg], "--evict")))
+                szEvict = szValue;
+            else
+                break;
+        }
+        if (iRepeat < 1 || argc - iArg < 2)
+            return 1;
+        return TimeCommand(iRepeat, szEvict, argv[iArg], argv + iArg + 1);
+    }
+
+    fprintf(stderr,
+        "Usage: stim-bench genlog [--years=N] [--tasks=N] [--switches=N]\n"
+        "                         [--logs=F] [--seed=N] [--start=YYYYMMDD]\n"
+        "       stim-bench time [--repeat=N] [--evict=FILE] <label> <command...>\n"
+        "       stim-bench stages [--repeat=N] <log>\n"
+        "       stim-bench threads [--threads=N] [--repeat=N] <log>\n"
+        "       stim-bench stamps [--count=N] [--seed=N]\n");
+    return 1;
+}